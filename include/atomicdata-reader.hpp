@@ -0,0 +1,178 @@
+/*
+
+In place reader for data serialized in the atomicassets attribute format.
+
+Serialized data is a sequence of (varint key, value) pairs, where the key is the index of the attribute
+in the schema format plus RESERVED. Only attributes that are set are serialized, in ascending key order.
+Instead of deserializing everything into an ATTRIBUTE_MAP, the functions in this file walk the byte
+stream and skip over values until they reach the one requested attribute.
+
+Needs to be included after atomicassets-interface.hpp, which defines the schema FORMAT.
+
+*/
+
+
+#include <eosio/eosio.hpp>
+
+using namespace eosio;
+using namespace std;
+
+namespace atomicdata {
+    //Keys below this value are reserved by the atomicassets serialization format
+    static constexpr uint64_t RESERVED = 4;
+
+    //Location of a single serialized attribute value inside the serialized data
+    struct ATTRIBUTE_VIEW {
+        bool   found  = false;
+        string type   = "";
+        size_t offset = 0; //position of the first byte of the value
+    };
+
+
+    /**
+    * Reads a varint at pos and advances pos past it
+    */
+    uint64_t read_varint(const vector <uint8_t> &data, size_t &pos) {
+        uint64_t value = 0;
+        for (uint64_t shift = 0; shift < 64; shift += 7) {
+            check(pos < data.size(), "Serialized data ended inside of a varint");
+            uint8_t byte = data[pos++];
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        check(false, "Serialized data contains a varint that is too long");
+        return 0;
+    }
+
+
+    /**
+    * Decodes a zigzag encoded integer, which is how signed integers are serialized
+    */
+    int64_t zigzag_decode(uint64_t value) {
+        return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+    }
+
+
+    /**
+    * Returns the size of values of the fixed size types, or 0 for variable size types
+    */
+    size_t get_fixed_size(const string &type) {
+        if (type == "fixed8" || type == "byte" || type == "bool") {
+            return 1;
+        } else if (type == "fixed16") {
+            return 2;
+        } else if (type == "fixed32" || type == "float") {
+            return 4;
+        } else if (type == "fixed64" || type == "double") {
+            return 8;
+        }
+        return 0;
+    }
+
+
+    /**
+    * Advances pos past one serialized value of the specified type
+    */
+    void skip_value(const vector <uint8_t> &data, size_t &pos, const string &type) {
+        if (type.size() > 2 && type.compare(type.size() - 2, 2, "[]") == 0) {
+            string element_type = type.substr(0, type.size() - 2);
+            uint64_t length = read_varint(data, pos);
+            size_t element_size = get_fixed_size(element_type);
+            if (element_size != 0) {
+                check(length <= (data.size() - pos) / element_size, "Serialized data ended inside of an array");
+                pos += length * element_size;
+            } else {
+                for (uint64_t i = 0; i < length; i++) {
+                    skip_value(data, pos, element_type);
+                }
+            }
+            return;
+        }
+
+        size_t fixed_size = get_fixed_size(type);
+        if (fixed_size != 0) {
+            check(fixed_size <= data.size() - pos, "Serialized data ended inside of a value");
+            pos += fixed_size;
+
+        } else if (type == "string" || type == "image" || type == "ipfs") {
+            uint64_t length = read_varint(data, pos);
+            check(length <= data.size() - pos, "Serialized data ended inside of a string");
+            pos += length;
+
+        } else if (type == "int8" || type == "int16" || type == "int32" || type == "int64"
+            || type == "uint8" || type == "uint16" || type == "uint32" || type == "uint64") {
+            read_varint(data, pos);
+
+        } else {
+            check(false, ("Unsupported attribute type - " + type).c_str());
+        }
+    }
+
+
+    /**
+    * Finds the serialized value of the attribute with the specified name
+    * Only the values in front of the attribute are skipped, nothing is copied or deserialized
+    */
+    ATTRIBUTE_VIEW find_attribute(
+        const vector <uint8_t> &data,
+        const vector <atomicassets::FORMAT> &format,
+        const string &attribute_name
+    ) {
+        uint64_t attribute_index = format.size();
+        for (uint64_t i = 0; i < format.size(); i++) {
+            if (format[i].name == attribute_name) {
+                attribute_index = i;
+                break;
+            }
+        }
+        if (attribute_index == format.size()) {
+            return {};
+        }
+
+        size_t pos = 0;
+        while (pos < data.size()) {
+            uint64_t key = read_varint(data, pos);
+            check(key >= RESERVED && key - RESERVED < format.size(), "Serialized data contains an invalid key");
+            uint64_t index = key - RESERVED;
+
+            if (index == attribute_index) {
+                return {.found = true, .type = format[index].type, .offset = pos};
+            } else if (index > attribute_index) {
+                //Keys are serialized in ascending order, so the attribute is not set
+                break;
+            }
+            skip_value(data, pos, format[index].type);
+        }
+        return {};
+    }
+
+
+    /**
+    * Converts a found string or integer attribute to a string, with integers in decimal notation
+    */
+    string attribute_to_string(const vector <uint8_t> &data, const ATTRIBUTE_VIEW &view) {
+        check(view.found, "The attribute is not set");
+        size_t pos = view.offset;
+
+        if (view.type == "string" || view.type == "image" || view.type == "ipfs") {
+            uint64_t length = read_varint(data, pos);
+            check(length <= data.size() - pos, "Serialized data ended inside of a string");
+            return string(data.begin() + pos, data.begin() + pos + length);
+
+        } else if (view.type == "uint8" || view.type == "uint16" || view.type == "uint32" || view.type == "uint64") {
+            return to_string(read_varint(data, pos));
+
+        } else if (view.type == "int8" || view.type == "int16" || view.type == "int32" || view.type == "int64") {
+            return to_string(zigzag_decode(read_varint(data, pos)));
+
+        } else if (view.type == "fixed8" || view.type == "byte") {
+            check(pos < data.size(), "Serialized data ended inside of a value");
+            return to_string(data[pos]);
+        }
+
+        check(false, ("Attributes of type " + view.type + " can't be used for weights").c_str());
+        return "";
+    }
+}
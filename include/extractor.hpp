@@ -2,37 +2,170 @@
 #include <eosio/singleton.hpp>
 #include <eosio/asset.hpp>
 #include <eosio/system.hpp>
-#include <eosio/crypto.hpp>
 
 #include <atomicassets-interface.hpp>
+#include <atomicdata-reader.hpp>
 #include <delphioracle-interface.hpp>
+#include <fixed-point.hpp>
 
 using namespace std;
 using namespace eosio;
 
 static constexpr name DEFAULT_MARKETPLACE_CREATOR = name("fees.atomic");
 
+//Scaling factor of the reward per unit accumulator, so that small emissions over many units don't round to 0
+static constexpr uint128_t REWARD_PRECISION = 1000000000000;
+
+//Template weight of templates without a matching rarity weight, in percent of the collection weight
+static constexpr uint64_t DEFAULT_TEMPLATE_WEIGHT = 100;
+
+//Upper bound for the work done per stake when validating, hashing and (un)packing its asset ids
+static constexpr uint64_t MAX_ASSETS_PER_STAKE = 100;
+
+//Number of oracle price samples kept in the price buffer for time weighted averages
+static constexpr uint64_t PRICE_BUFFER_SIZE = 48;
+
+//Migration steps, each named after the table that it migrates and that is locked while it runs
+static constexpr name MIGRATION_STEP_COUNTERS = name("counters"); //config stake_counter -> counters
+static constexpr name MIGRATION_STEP_ACCOUNTS = name("accounts"); //legacy balances -> accounts
+
+//Upper bound for the number of stakes returned by one page of the stake query actions
+static constexpr uint32_t MAX_STAKES_PER_PAGE = 100;
+
+//Phases of the collection stats consistency check
+static constexpr uint8_t STATS_CHECK_IDLE = 0;
+static constexpr uint8_t STATS_CHECK_TALLY = 1; //tallying the stakes table into the statstally table
+static constexpr uint8_t STATS_CHECK_COMPARE = 2; //comparing the tallies with the collstats table
+
+static constexpr uint8_t LOG_MODE_NONE = 0;
+static constexpr uint8_t LOG_MODE_INLINE = 1;
+static constexpr uint8_t LOG_MODE_PRINT = 2;
+
 
 /**
-* This function takes a vector of asset ids, sorts them and then returns the sha256 hash
-* It should therefore return the same hash for two vectors if and only if both vectors include
-* exactly the same asset ids in any order
+* This function takes a vector of asset ids and encodes it in a compact, canonical form
+* The ids are sorted and each id is stored as the varint encoded difference to the previous id
+* AtomicAssets ids of assets that are staked together are usually close to each other,
+* so most ids only take one or two bytes instead of eight
 */
-checksum256 hash_asset_ids(const vector <uint64_t> &asset_ids) {
-    uint64_t asset_ids_array[asset_ids.size()];
-    std::copy(asset_ids.begin(), asset_ids.end(), asset_ids_array);
-    std::sort(asset_ids_array, asset_ids_array + asset_ids.size());
+vector <uint8_t> pack_asset_ids(const vector <uint64_t> &asset_ids) {
+    vector <uint64_t> sorted_asset_ids = asset_ids;
+    std::sort(sorted_asset_ids.begin(), sorted_asset_ids.end());
+
+    vector <uint8_t> packed_asset_ids;
+    packed_asset_ids.reserve(sorted_asset_ids.size() * 2 + 8);
+
+    uint64_t previous_asset_id = 0;
+    for (uint64_t asset_id : sorted_asset_ids) {
+        uint64_t delta = asset_id - previous_asset_id;
+        while (delta >= 0x80) {
+            packed_asset_ids.push_back((uint8_t) (delta | 0x80));
+            delta >>= 7;
+        }
+        packed_asset_ids.push_back((uint8_t) delta);
+        previous_asset_id = asset_id;
+    }
+
+    return packed_asset_ids;
+};
+
 
-    return eosio::sha256((char *) asset_ids_array, sizeof(asset_ids_array));
+/**
+* This function decodes asset ids encoded with pack_asset_ids
+* The returned asset ids are sorted in ascending order
+*/
+vector <uint64_t> unpack_asset_ids(const vector <uint8_t> &packed_asset_ids) {
+    vector <uint64_t> asset_ids;
+
+    uint64_t previous_asset_id = 0;
+    uint64_t delta = 0;
+    uint8_t shift = 0;
+    for (uint8_t byte : packed_asset_ids) {
+        delta |= (uint64_t) (byte & 0x7F) << shift;
+        if (byte & 0x80) {
+            shift += 7;
+            continue;
+        }
+        previous_asset_id += delta;
+        asset_ids.push_back(previous_asset_id);
+        delta = 0;
+        shift = 0;
+    }
+
+    return asset_ids;
 };
 
 
+/**
+* This function parses a decimal number that fits into 64 bits, e.g. an id in a memo
+* Unlike std::stoull, it fails with error_message instead of throwing if the string is not such a number
+*/
+uint64_t parse_uint64(const string &digits, const char *error_message) {
+    check(digits.size() != 0, error_message);
+
+    uint64_t value = 0;
+    for (char digit : digits) {
+        check(digit >= '0' && digit <= '9', error_message);
+        uint64_t digit_value = (uint64_t) (digit - '0');
+        check(value <= (UINT64_MAX - digit_value) / 10, error_message);
+        value = value * 10 + digit_value;
+    }
+    return value;
+};
+
+
+
+
 CONTRACT extractor : public contract {
 public:
     using contract::contract;
+
+    //Host test harness, see tests/extractor_host.hpp
+    friend class extractor_host;
+
+    struct COUNTER_RANGE {
+        name counter_name;
+        uint64_t start_id;
+        uint64_t end_id; //inclusive
+    };
+
+    struct RARITY_WEIGHT {
+        string   value; //attribute value, integers in decimal notation
+        uint64_t weight; //in percent of the collection weight
+    };
+
+    struct STAKE_VIEW {
+        uint64_t          stake_id;
+        name              owner;
+        name              collection_name;
+        vector <uint64_t> asset_ids;
+        uint64_t          units;
+        bool              custodial;
+    };
+
+    struct STAKES_PAGE {
+        vector <STAKE_VIEW> stakes;
+        bool                more; //whether there are more stakes after this page
+        uint64_t            next_stake_id; //lower_stake_id of the next page
+    };
+
+    struct OWNER_CREDIT {
+        name  owner;
+        asset quantity;
+    };
+
     //utility
     ACTION init();
-    ACTION convcounters();
+
+    // start a migration step, which locks the table it migrates until it is finished
+    ACTION startmigr(
+        name step
+    );
+
+    // migrate up to max_rows rows of the running migration step
+    ACTION migrate(
+        uint64_t max_rows
+    );
 
     //set version
     ACTION setversion(
@@ -44,6 +177,57 @@ public:
         name token_contract
     );
 
+    // add or re-enable a token in the token registry
+    ACTION addtoken(
+        name token_contract,
+        symbol token_symbol
+    );
+
+    // retire a token from the token registry
+    ACTION retiretoken(
+        symbol_code token_symbol_code
+    );
+
+    // set how log actions are emitted
+    ACTION setlogmode(
+        uint8_t log_mode
+    );
+
+    // append a segment to the emission schedule
+    ACTION addsegment(
+        time_point_sec start_time,
+        asset emission_per_period
+    );
+
+    // whitelist a collection for staking and set the units that each of its staked assets adds to its stake
+    ACTION setcollrate(
+        name collection_name,
+        uint64_t weight
+    );
+
+    // weight the staked assets of a collection by an attribute of their templates
+    ACTION setrarity(
+        name collection_name,
+        string attribute_name,
+        vector <RARITY_WEIGHT> weights,
+        uint64_t default_weight
+    );
+
+    // set the delphioracle pair sampled by pokeprice
+    ACTION setpricepair(
+        name delphi_pair_name,
+        uint32_t min_poke_interval,
+        uint32_t max_datapoint_age
+    );
+
+    // sample the current delphioracle median into the price buffer
+    ACTION pokeprice();
+
+    // get the time weighted average price of the last window_seconds
+    [[eosio::action, eosio::read_only]] uint64_t gettwap(
+        uint32_t window_seconds
+    );
+
     // claim token
     ACTION claim(
         name owner,
@@ -53,10 +237,28 @@ public:
     //consume counter : unique
     uint64_t consume_counter(name counter_name);
 
+    //reserve a contiguous block of count ids with a single counter update
+    COUNTER_RANGE reserve_counter_range(name counter_name, uint64_t count);
+
+    // get the id ranges that have been handed out by each counter
+    [[eosio::action, eosio::read_only]] vector <COUNTER_RANGE> getcounters();
+
     // stake apoc items
     ACTION stake(
-        name seller,
-        vector <uint64_t> asset_ids,
+        name owner,
+        vector <uint64_t> asset_ids
+    );
+
+    // stake multiple groups of apoc items at once, creating one stake per group
+    ACTION stakemany(
+        name owner,
+        vector <vector <uint64_t>> asset_ids_groups
+    );
+
+    // open a custodial stake, paying its RAM, that becomes active once its assets are transferred to the contract
+    ACTION openstake(
+        name owner,
+        vector <uint64_t> asset_ids
     );
 
     // unstake apoc token
@@ -64,41 +266,143 @@ public:
         uint64_t stake_id
     );
 
+    // add apoc items to an existing stake
+    ACTION addtostake(
+        uint64_t stake_id,
+        vector <uint64_t> asset_ids
+    );
+
+    // remove apoc items from an existing stake
+    ACTION removefromstake(
+        uint64_t stake_id,
+        vector <uint64_t> asset_ids
+    );
+
+    // remove invalid stakes in bounded batches
+    ACTION sweep(
+        uint64_t max_rows
+    );
+
+    // settle the rewards of a stake into the owner's balance
+    ACTION claimstake(
+        uint64_t stake_id
+    );
+
+    // verify the collection stats against the stakes table in bounded batches
+    ACTION checkstats(
+        uint64_t max_rows
+    );
+
+    // settle the rewards of up to max_stakes stakes into their owners' balances
+    ACTION distribute(
+        uint64_t max_stakes
+    );
+
+    // get a page of the stakes of an owner, starting at lower_stake_id
+    [[eosio::action, eosio::read_only]] STAKES_PAGE getstakes(
+        name owner,
+        uint64_t lower_stake_id,
+        uint32_t limit
+    );
+
+    // get a page of the stakes of a collection, starting at lower_stake_id
+    [[eosio::action, eosio::read_only]] STAKES_PAGE getcollstakes(
+        name collection_name,
+        uint64_t lower_stake_id,
+        uint32_t limit
+    );
+
 
 
-    void receive_token_transfer(
+    [[eosio::on_notify("*::transfer")]] void receive_token_transfer(
         name from,
         name to,
         asset quantity,
         string memo
     );
 
+    [[eosio::on_notify("atomicassets::transfer")]] void receive_asset_transfer(
+        name from,
+        name to,
+        vector <uint64_t> asset_ids,
+        string memo
+    );
+
     ACTION lognewstake(
         uint64_t stake_id,
         name owner,
         vector <uint64_t> asset_ids,
-        name collection_name,
+        name collection_name
+    );
+
+    ACTION lognewstakes(
+        uint64_t first_stake_id,
+        name owner,
+        vector <vector <uint64_t>> asset_ids_groups,
+        vector <name> collection_names
+    );
+
+    ACTION logsweep(
+        uint64_t examined_rows,
+        uint64_t reclaimed_rows,
+        uint64_t next_cursor
+    );
+
+    ACTION logchkstats(
+        uint8_t phase,
+        uint64_t examined_rows,
+        uint64_t mismatched_rows,
+        uint64_t next_cursor
+    );
+
+    ACTION logdistrib(
+        uint64_t examined_stakes,
+        uint64_t removed_stakes,
+        vector <OWNER_CREDIT> owner_credits,
+        asset distributed_quantity,
+        uint64_t next_cursor
     );
 
     ACTION lognewclaim(
         name owner,
         vector <uint64_t> asset_ids,
-        double amount
+        asset amount
     );
 
 
 private:
-    struct COUNTER_RANGE {
-        name counter_name;
-        uint64_t start_id;
-        uint64_t end_id;
-    };
-
     struct TOKEN {
         name   token_contract;
         symbol token_symbol;
     };
 
+    struct PRICE_SAMPLE {
+        time_point_sec timestamp;
+        uint64_t       price;
+        uint128_t      cumulative_price; //sum of price * seconds from the first sample up to timestamp
+    };
+
+    TABLE counters_s {
+        name     counter_name;
+        uint64_t counter_value;
+
+        uint64_t primary_key() const { return counter_name.value; };
+    };
+
+    typedef multi_index <name("counters"), counters_s> counters_t;
+
+
+    TABLE cursors_s { //positions at which batch actions resume
+        name     cursor_name;
+        uint64_t position;
+
+        uint64_t primary_key() const { return cursor_name.value; };
+    };
+
+    typedef multi_index <name("cursors"), cursors_s> cursors_t;
+
+
+    //Legacy layout, only kept until all rows are migrated into the accounts table
     TABLE balances_s {
         name           owner;
         vector <asset> quantities;
@@ -109,23 +413,58 @@ private:
     typedef multi_index <name("balances"), balances_s> balances_t;
 
 
+    //Scope: owner
+    TABLE accounts_s {
+        asset          balance;
+
+        uint64_t primary_key() const { return balance.symbol.code().raw(); };
+    };
+
+    typedef multi_index <name("accounts"), accounts_s> accounts_t;
+
+
     TABLE stake_s { // table for staking pool
         uint64_t          stake_id;
         name              owner;
-        vector <uint64_t> asset_ids;
-        int64_t           offer_id; //-1 if no offer has been created yet, else the offer id
         name              collection_name;
+        vector <uint8_t>  packed_asset_ids; //encoded with pack_asset_ids
+        uint64_t          units;
+        uint128_t         reward_checkpoint; //reward_per_unit at the time the stake was last settled
+        binary_extension <bool> custodial; //the assets are held by the contract instead of the owner
+        binary_extension <bool> pending; //custodial stake opened with openstake, its assets are not transferred yet
 
         uint64_t primary_key() const { return stake_id; };
 
-        checksum256 asset_ids_hash() const { return hash_asset_ids(asset_ids); };
+        bool is_custodial() const { return custodial.value_or(false); };
+
+        bool is_pending() const { return pending.value_or(false); };
+
+        uint128_t by_owner() const { return ((uint128_t) owner.value << 64) | stake_id; };
+
+        uint128_t by_collection() const { return ((uint128_t) collection_name.value << 64) | stake_id; };
+
+        vector <uint64_t> get_asset_ids() const { return unpack_asset_ids(packed_asset_ids); };
+
+        void set_asset_ids(const vector <uint64_t> &asset_ids) { packed_asset_ids = pack_asset_ids(asset_ids); };
     };
 
     typedef multi_index <name("stakes"), stake_s,
-        indexed_by < name("assetidshash"), const_mem_fun < stake_s, checksum256, &stake_s::asset_ids_hash>>>
+        indexed_by < name("owner"), const_mem_fun < stake_s, uint128_t, &stake_s::by_owner>>,
+        indexed_by < name("collection"), const_mem_fun < stake_s, uint128_t, &stake_s::by_collection>>>
     stake_t;
 
 
+    TABLE stakedassets_s { //reverse index of the stakes table
+        uint64_t          asset_id;
+        uint64_t          stake_id;
+        uint64_t          units; //units that the asset adds to the stake
+
+        uint64_t primary_key() const { return asset_id; };
+    };
+
+    typedef multi_index <name("stakedassets"), stakedassets_s> stakedassets_t;
+
+
 
 
     TABLE config_s {
@@ -134,34 +473,216 @@ private:
         uint32_t            minimum_claim_duration =  1440; // 1 day
         uint32_t            minimum_calc_duaration = 720; //12 hours
         TOKEN               apoc_token               = {
-            .token_symbol = symbol("APOC"),
-            .token_contract = name("apocalyptics")};
+            .token_contract = name("apocalyptics"),
+            .token_symbol = symbol("APOC", 4)};
         name                atomicassets_account     = atomicassets::ATOMICASSETS_ACCOUNT;
+        binary_extension <uint8_t> log_mode; //not set in config rows written before the log mode existed
+
+        uint8_t get_log_mode() const { return log_mode.value_or(LOG_MODE_INLINE); };
     };
     typedef singleton <name("config"), config_s>               config_t;
     // https://github.com/EOSIO/eosio.cdt/issues/280
     typedef multi_index <name("config"), config_s>             config_t_for_abi;
 
 
+    TABLE migration_s { //only exists while a migration step is running
+        name                step;
+        uint64_t            cursor                   = 0; //primary key at which the next batch continues
+        uint64_t            migrated_rows            = 0;
+    };
+    typedef singleton <name("migration"), migration_s>         migration_t;
+    typedef multi_index <name("migration"), migration_s>       migration_t_for_abi;
+
+
+    TABLE emission_s { //piecewise constant emission schedule, each segment lasts until the next one starts
+        time_point_sec      start_time;
+        uint64_t            emission_per_period; //in the smallest unit of the apoc token
+        uint128_t           cumulative_emission; //emission before start_time, multiplied by the period length
+
+        uint64_t primary_key() const { return start_time.sec_since_epoch(); };
+    };
+    typedef multi_index <name("emission"), emission_s>         emission_t;
+
+
+    TABLE collrates_s {
+        name                collection_name;
+        uint64_t            weight; //units per staked asset, collections without a row can't be staked
+
+        uint64_t primary_key() const { return collection_name.value; };
+    };
+    typedef multi_index <name("collrates"), collrates_s>       collrates_t;
+
+
+    TABLE collstats_s { //aggregates of the stakes of a collection, updated with every stake change
+        name                collection_name;
+        uint64_t            staked_items             = 0;
+        uint64_t            stake_count              = 0;
+        uint64_t            units                    = 0;
+        uint64_t            rewards_settled          = 0; //in the smallest unit of the apoc token
+
+        uint64_t primary_key() const { return collection_name.value; };
+    };
+    typedef multi_index <name("collstats"), collstats_s>       collstats_t;
+
+
+    TABLE statstally_s { //scratch tallies of a running checkstats
+        name                collection_name;
+        uint64_t            staked_items             = 0;
+        uint64_t            stake_count              = 0;
+        uint64_t            units                    = 0;
+
+        uint64_t primary_key() const { return collection_name.value; };
+    };
+    typedef multi_index <name("statstally"), statstally_s>     statstally_t;
+
+
+    TABLE statscheck_s {
+        uint8_t             phase                    = STATS_CHECK_IDLE;
+        uint64_t            cursor                   = 0; //stake_id while tallying, collection_name while comparing
+        uint64_t            mismatched_rows          = 0;
+    };
+    typedef singleton <name("statscheck"), statscheck_s>       statscheck_t;
+    typedef multi_index <name("statscheck"), statscheck_s>     statscheck_t_for_abi;
+
+
+    TABLE rarityconf_s { //template attribute that weights the assets of a collection
+        name                  collection_name;
+        string                attribute_name;
+        vector <RARITY_WEIGHT> weights;
+        uint64_t              default_weight; //for templates without the attribute or a matching value
+        uint64_t              config_id; //changes with every update, invalidating the cached template weights
+
+        uint64_t primary_key() const { return collection_name.value; };
+    };
+    typedef multi_index <name("rarityconf"), rarityconf_s>     rarityconf_t;
+
+
+    //Scope: collection_name
+    TABLE tmplweights_s { //cache of the template weights resolved from the rarity config
+        int32_t             template_id;
+        uint64_t            weight;
+        uint64_t            config_id; //config_id of the rarity config that the weight was resolved with
+
+        uint64_t primary_key() const { return (uint64_t) template_id; };
+    };
+    typedef multi_index <name("tmplweights"), tmplweights_s>   tmplweights_t;
+
+
+    TABLE tokens_s { //registry of the tokens that can be deposited and paid out as rewards
+        symbol              token_symbol;
+        name                token_contract;
+        bool                enabled;
+
+        uint64_t primary_key() const { return token_symbol.code().raw(); };
+    };
+    typedef multi_index <name("tokens"), tokens_s>             tokens_t;
+
+
+    TABLE pricebuffer_s { //ring buffer of delphioracle samples
+        name                  delphi_pair_name;
+        uint32_t              min_poke_interval        = 0; //in seconds
+        uint32_t              max_datapoint_age        = 0; //in seconds, older datapoints are not sampled
+        uint64_t              next_index               = 0; //position that the next sample overwrites once full
+        vector <PRICE_SAMPLE> samples                  = {};
+    };
+    typedef singleton <name("pricebuffer"), pricebuffer_s>     pricebuffer_t;
+    typedef multi_index <name("pricebuffer"), pricebuffer_s>   pricebuffer_t_for_abi;
+
+
+    TABLE rewards_s {
+        uint128_t           reward_per_unit          = 0; //scaled by REWARD_PRECISION
+        uint64_t            total_units              = 0;
+        time_point_sec      last_accrual;
+        uint128_t           last_cumulative_emission = 0; //get_cumulative_emission(last_accrual)
+    };
+    typedef singleton <name("rewards"), rewards_s>             rewards_t;
+    typedef multi_index <name("rewards"), rewards_s>           rewards_t_for_abi;
+
+
     stake_t        pool         = stake_t(get_self(), get_self().value);
+    stakedassets_t stakedassets = stakedassets_t(get_self(), get_self().value);
     balances_t     balances     = balances_t(get_self(), get_self().value);
     counters_t     counters     = counters_t(get_self(), get_self().value);
+    cursors_t      cursors      = cursors_t(get_self(), get_self().value);
     config_t       config       = config_t(get_self(), get_self().value);
+    rewards_t      rewards      = rewards_t(get_self(), get_self().value);
+    tokens_t       tokens       = tokens_t(get_self(), get_self().value);
+    emission_t     emission     = emission_t(get_self(), get_self().value);
+    collrates_t    collrates    = collrates_t(get_self(), get_self().value);
+    rarityconf_t   rarityconf   = rarityconf_t(get_self(), get_self().value);
+    pricebuffer_t  pricebuffer  = pricebuffer_t(get_self(), get_self().value);
+    migration_t    migration    = migration_t(get_self(), get_self().value);
+    collstats_t    collstats    = collstats_t(get_self(), get_self().value);
+    statstally_t   statstally   = statstally_t(get_self(), get_self().value);
+    statscheck_t   statscheck   = statscheck_t(get_self(), get_self().value);
 
+    std::optional <config_s> config_cache;
+    std::optional <name>     migrating_table_cache;
+    std::optional <statscheck_s> statscheck_cache;
 
-    name get_collection_and_check_assets(name owner, vector <uint64_t> asset_ids);
 
-    name get_collection_author(name collection_name);
+    accounts_t get_accounts(name owner) {
+        return accounts_t(get_self(), owner.value);
+    }
 
-    double get_collection_fee(name collection_name);
+    tmplweights_t get_tmplweights(name collection_name) {
+        return tmplweights_t(get_self(), collection_name.value);
+    }
 
+    const config_s &get_config();
 
+    void set_config(const config_s &new_config);
 
+    void check_not_migrating(name table_name);
 
-    name require_get_supported_token_contract(symbol token_symbol);
+    bool internal_migrate_counters(migration_s &migration_state, uint64_t max_rows);
+
+    bool internal_migrate_accounts(migration_s &migration_state, uint64_t max_rows);
 
-    SYMBOLPAIR require_get_symbol_pair(symbol listing_symbol, symbol settlement_symbol);
 
+    name get_collection_and_check_assets(
+        name owner,
+        const vector <uint64_t> &asset_ids,
+        vector <int32_t> &template_ids
+    );
+
+    /**
+    * Emits a log event according to the log mode in the config
+    * log_data needs to match the parameters of the log action with the name log_action
+    */
+    template <typename T>
+    void log_event(name log_action, const T &log_data) {
+        uint8_t log_mode = get_config().get_log_mode();
+        if (log_mode == LOG_MODE_INLINE) {
+            send_log_action(log_action, log_data);
+        } else if (log_mode == LOG_MODE_PRINT) {
+            print_event(log_action, pack(log_data));
+        }
+    }
+
+    /**
+    * Sends a log action as an inline action to the contract itself, regardless of the log mode
+    * The progress reports of the batch actions are always sent like this, because their callers need them
+    * to know when to stop calling
+    */
+    template <typename T>
+    void send_log_action(name log_action, const T &log_data) {
+        action(
+            permission_level{get_self(), name("active")},
+            get_self(),
+            log_action,
+            log_data
+        ).send();
+    }
+
+    void print_event(name log_action, const vector <char> &packed_data);
+
+    name get_collection_author(name collection_name);
+
+
+
+
+    name require_get_supported_token_contract(symbol token_symbol);
 
     bool is_token_supported(name token_contract, symbol token_symbol);
 
@@ -179,4 +700,104 @@ private:
 
     void internal_transfer_assets(name to, vector <uint64_t> asset_ids, string memo);
 
+    uint64_t get_twap(uint32_t window_seconds);
+
+    uint128_t get_cumulative_emission(uint32_t time);
+
+    uint64_t get_collection_weight(name collection_name);
+
+    uint64_t get_template_weight(const rarityconf_s &collection_rarityconf, int32_t template_id, name payer);
+
+    vector <uint64_t> get_asset_units(name collection_name, const vector <int32_t> &template_ids, name payer);
+
+    rewards_s get_accrued_rewards();
+
+    int64_t get_pending_rewards(const rewards_s &rewards_state, const stake_s &stake);
+
+    void internal_settle_stake(const rewards_s &rewards_state, const stake_s &stake);
+
+    void internal_add_settled_rewards(name collection_name, int64_t amount);
+
+    uint64_t get_cursor(name cursor_name);
+
+    void set_cursor(name cursor_name, uint64_t position);
+
+    bool is_stake_valid(const stake_s &stake);
+
+    void check_stake_valid(const stake_s &stake);
+
+    /**
+    * Reads a page of stakes from a secondary index of the stakes table with (key << 64 | stake_id) keys
+    * Only the rows of the page and one row after it are read
+    */
+    template <typename index_t>
+    STAKES_PAGE get_stakes_page(const index_t &stakes_index, name key, uint64_t lower_stake_id, uint32_t limit) {
+        check(limit != 0 && limit <= MAX_STAKES_PER_PAGE,
+            ("limit needs to be between 1 and " + to_string(MAX_STAKES_PER_PAGE)).c_str());
+
+        STAKES_PAGE page = {.stakes = {}, .more = false, .next_stake_id = 0};
+
+        auto stake_itr = stakes_index.lower_bound(((uint128_t) key.value << 64) | lower_stake_id);
+        auto end_itr = stakes_index.upper_bound(((uint128_t) key.value << 64) | UINT64_MAX);
+        while (stake_itr != end_itr) {
+            if (page.stakes.size() == limit) {
+                page.more = true;
+                page.next_stake_id = stake_itr->stake_id;
+                break;
+            }
+            page.stakes.push_back({
+                .stake_id = stake_itr->stake_id,
+                .owner = stake_itr->owner,
+                .collection_name = stake_itr->collection_name,
+                .asset_ids = stake_itr->get_asset_ids(),
+                .units = stake_itr->units,
+                .custodial = stake_itr->is_custodial()
+            });
+            stake_itr++;
+        }
+
+        return page;
+    }
+
+    void internal_create_stake(
+        rewards_s &rewards_state,
+        uint64_t stake_id,
+        name owner,
+        const vector <uint64_t> &asset_ids,
+        const vector <int32_t> &template_ids,
+        name collection_name,
+        bool custodial
+    );
+
+    void internal_extend_stake(
+        rewards_s &rewards_state,
+        stake_t::const_iterator stake_itr,
+        const vector <uint64_t> &asset_ids,
+        const vector <int32_t> &template_ids
+    );
+
+    void internal_add_staked_assets(
+        rewards_s &rewards_state,
+        uint64_t stake_id,
+        name owner,
+        const vector <uint64_t> &asset_ids,
+        const vector <uint64_t> &asset_units
+    );
+
+    void internal_activate_stake(
+        rewards_s &rewards_state,
+        stake_t::const_iterator stake_itr,
+        const vector <uint64_t> &asset_ids
+    );
+
+    void internal_remove_stake(rewards_s &rewards_state, stake_t::const_iterator stake_itr, bool forfeit_rewards);
+
+    void internal_update_collstats(
+        name collection_name,
+        uint64_t stake_id,
+        int64_t staked_items_delta,
+        int64_t stake_count_delta,
+        int64_t units_delta
+    );
+
 };
\ No newline at end of file
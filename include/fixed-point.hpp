@@ -0,0 +1,64 @@
+/*
+
+Deterministic integer arithmetic for reward, unit and price computations.
+
+All products are computed with 128 bit intermediates and checked for overflow, so results never
+silently wrap. Every division rounds down, so that the contract never pays out more than it emitted
+and off-chain systems can reproduce every result bit for bit. Floating point is avoided completely,
+because it is both slow (softfloat in WASM) and a source of rounding drift.
+
+*/
+
+
+#include <eosio/eosio.hpp>
+
+using namespace eosio;
+
+namespace fixedpoint {
+    static constexpr uint128_t UINT128_MAXIMUM = ~(uint128_t) 0;
+
+
+    /**
+    * Multiplies a and b, failing if the result does not fit into 128 bits
+    */
+    uint128_t checked_mul(uint128_t a, uint128_t b) {
+        check(a == 0 || b <= UINT128_MAXIMUM / a, "Fixed point multiplication overflow");
+        return a * b;
+    }
+
+
+    /**
+    * Divides dividend by divisor, rounding the result down
+    */
+    uint128_t div(uint128_t dividend, uint128_t divisor) {
+        check(divisor != 0, "Fixed point division by zero");
+        return dividend / divisor;
+    }
+
+
+    /**
+    * Computes a * b / divisor with a 128 bit intermediate product, rounding the result down
+    */
+    uint128_t mul_div(uint128_t a, uint128_t b, uint128_t divisor) {
+        return div(checked_mul(a, b), divisor);
+    }
+
+
+    /**
+    * Converts a result into a token amount, failing if it exceeds the range of asset amounts
+    */
+    int64_t to_amount(uint128_t value) {
+        check(value <= (uint128_t) asset::max_amount, "Fixed point result exceeds the maximum asset amount");
+        return (int64_t) value;
+    }
+
+
+    /**
+    * Narrows a result to 64 bits, e.g. a count, a number of bytes or a number of units,
+    * failing if it does not fit
+    */
+    uint64_t to_uint64(uint128_t value) {
+        check(value <= (uint128_t) UINT64_MAX, "Fixed point result exceeds 64 bits");
+        return (uint64_t) value;
+    }
+};
@@ -1,7 +1,5 @@
 #include <extractor.hpp>
 
-#include <math.h>
-
 
 /**
 * Initializes the config table. Only needs to be called once when first deploying the contract
@@ -10,47 +8,75 @@
 */
 ACTION extractor::init() {
     require_auth(get_self());
-    config.get_or_create(get_self(), config_s{});
-
-    if (marketplaces.find(name("").value) == marketplaces.end()) {
-        marketplaces.emplace(get_self(), [&](auto &_marketplace) {
-            _marketplace.marketplace_name = name("");
-            _marketplace.creator = DEFAULT_MARKETPLACE_CREATOR;
+    config_s current_config = config.get_or_create(get_self(), config_s{});
+    rewards.get_or_create(get_self(), rewards_s{});
+
+    //The apoc token is the reward token and therefore always needs to be withdrawable
+    if (tokens.find(current_config.apoc_token.token_symbol.code().raw()) == tokens.end()) {
+        tokens.emplace(get_self(), [&](auto &_token) {
+            _token.token_symbol = current_config.apoc_token.token_symbol;
+            _token.token_contract = current_config.apoc_token.token_contract;
+            _token.enabled = true;
         });
     }
 }
 
 
 /**
-* Converts the now deprecated stake and auction counters in the config singleton
-* into using the counters table
+* Starts a migration step
+* While the step is running, the table that it migrates is locked for user actions.
+* The step is then advanced by calling migrate repeatedly
 * 
-* Calling this only is necessary when upgrading the contract from a lower version to 1.2.0
-* When deploying a fresh contract, this action can be ignored completely
+* Migrations are only necessary when upgrading the contract from a lower version
+* When deploying a fresh contract, they can be ignored completely
 * 
 * @required_auth The contract itself
 */
-ACTION extractor::convcounters() {
+ACTION extractor::startmigr(
+    name step
+) {
     require_auth(get_self());
 
-    config_s current_config = config.get();
+    check(!migration.exists(), "Another migration step is still running");
+    check(step == MIGRATION_STEP_COUNTERS || step == MIGRATION_STEP_ACCOUNTS,
+        "Unknown migration step");
 
-    check(current_config.stake_counter != 0 && current_config.auction_counter != 0,
-        "The stake counters have already been converted");
+    migration.set(migration_s{.step = step}, get_self());
+    migrating_table_cache = step;
+}
 
-    counters.emplace(get_self(), [&](auto &_counter) {
-        _counter.counter_name = name("stake");
-        _counter.counter_value = current_config.stake_counter;
-    });
-    current_config.stake_counter = 0;
 
-    counters.emplace(get_self(), [&](auto &_counter) {
-        _counter.counter_name = name("auction");
-        _counter.counter_value = current_config.auction_counter;
-    });
-    current_config.auction_counter = 0;
+/**
+* Migrates up to max_rows rows of the running migration step, continuing at the cursor of the previous call
+* Once all rows are migrated, the migration state is removed and the table is unlocked again
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::migrate(
+    uint64_t max_rows
+) {
+    require_auth(get_self());
+
+    check(max_rows != 0, "max_rows needs to be at least 1");
+    check(migration.exists(), "No migration step is running");
+
+    migration_s migration_state = migration.get();
+
+    bool finished = false;
+    if (migration_state.step == MIGRATION_STEP_COUNTERS) {
+        finished = internal_migrate_counters(migration_state, max_rows);
+    } else if (migration_state.step == MIGRATION_STEP_ACCOUNTS) {
+        finished = internal_migrate_accounts(migration_state, max_rows);
+    } else {
+        check(false, "Unknown migration step");
+    }
 
-    config.set(current_config, get_self());
+    if (finished) {
+        migration.remove();
+        migrating_table_cache = name();
+    } else {
+        migration.set(migration_state, get_self());
+    }
 }
 
 
@@ -62,10 +88,10 @@ ACTION extractor::convcounters() {
 ACTION extractor::setversion(string new_version) {
     require_auth(get_self());
 
-    config_s current_config = config.get();
+    config_s current_config = get_config();
     current_config.version = new_version;
 
-    config.set(current_config, get_self());
+    set_config(current_config);
 }
 
 
@@ -77,12 +103,314 @@ ACTION extractor::setversion(string new_version) {
 ACTION extractor::setapocaddr(name token_contract) {
     require_auth(get_self());
 
-    config_s current_config = config.get();
+    config_s current_config = get_config();
     current_config.apoc_token.token_contract = token_contract;
-    config.set(current_config, get_self());
+    set_config(current_config);
+
+    auto token_itr = tokens.require_find(current_config.apoc_token.token_symbol.code().raw(),
+        "The apoc token is not registered. Call the init action first");
+    tokens.modify(token_itr, same_payer, [&](auto &_token) {
+        _token.token_contract = token_contract;
+    });
+}
+
+
+/**
+* Adds a token to the token registry, or re-enables a retired token
+* Enabled tokens can be deposited and paid out as rewards
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::addtoken(
+    name token_contract,
+    symbol token_symbol
+) {
+    require_auth(get_self());
+
+    check(is_account(token_contract), "token_contract account does not exist");
+    check(token_symbol.is_valid(), "token_symbol is invalid");
+
+    auto token_itr = tokens.find(token_symbol.code().raw());
+    if (token_itr == tokens.end()) {
+        tokens.emplace(get_self(), [&](auto &_token) {
+            _token.token_symbol = token_symbol;
+            _token.token_contract = token_contract;
+            _token.enabled = true;
+        });
+    } else {
+        check(token_itr->token_contract == token_contract && token_itr->token_symbol == token_symbol,
+            "A different token with this symbol code is already registered");
+        check(!token_itr->enabled, "The token is already enabled");
+        tokens.modify(token_itr, same_payer, [&](auto &_token) {
+            _token.enabled = true;
+        });
+    }
+}
+
+
+/**
+* Retires a token from the token registry
+* Retired tokens can no longer be deposited, but existing balances can still be withdrawn
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::retiretoken(
+    symbol_code token_symbol_code
+) {
+    require_auth(get_self());
+
+    check(token_symbol_code != get_config().apoc_token.token_symbol.code(), "The apoc token can't be retired");
+
+    auto token_itr = tokens.require_find(token_symbol_code.raw(),
+        "No token with this symbol code is registered");
+    check(token_itr->enabled, "The token is already retired");
+    tokens.modify(token_itr, same_payer, [&](auto &_token) {
+        _token.enabled = false;
+    });
+}
+
+
+/**
+* Sets how the log actions (lognewstake, lognewstakes, lognewclaim) are emitted
+* 
+* LOG_MODE_NONE:   Nothing is logged
+* LOG_MODE_INLINE: Every event is sent as an inline action to the contract itself
+* LOG_MODE_PRINT:  Every event is printed to the action's console as its serialized log action data,
+*                  avoiding the cost of dispatching an inline action
+* 
+* The progress reports of the batch actions (logsweep, logchkstats, logdistrib) are always sent as inline
+* actions, because callers of these actions need them to continue their batches
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::setlogmode(uint8_t log_mode) {
+    require_auth(get_self());
+
+    check(log_mode == LOG_MODE_NONE || log_mode == LOG_MODE_INLINE || log_mode == LOG_MODE_PRINT,
+        "Invalid log mode");
+
+    config_s current_config = get_config();
+    current_config.log_mode = log_mode;
+    set_config(current_config);
+}
+
+
+/**
+* Appends a segment to the emission schedule
+* From start_time on, emission_per_period is emitted per accrual period (minimum_calc_duaration), accruing
+* every second, and split between all staked units proportionally, until the next segment starts
+* 
+* Segments can only be appended for the future, so already accrued rewards and existing stakes are
+* not affected
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::addsegment(
+    time_point_sec start_time,
+    asset emission_per_period
+) {
+    require_auth(get_self());
+
+    check(emission_per_period.is_valid(), "Invalid type emission_per_period");
+    check(emission_per_period.amount >= 0, "The emission must not be negative");
+    check(emission_per_period.symbol == get_config().apoc_token.token_symbol,
+        "The emission must be specified in the apoc token");
+    check(start_time.sec_since_epoch() >= current_time_point().sec_since_epoch(),
+        "Segments can't start in the past");
+
+    auto last_segment_itr = emission.rbegin();
+    check(last_segment_itr == emission.rend() || last_segment_itr->start_time < start_time,
+        "Segments need to start after the last segment of the schedule");
+
+    uint128_t cumulative_emission = get_cumulative_emission(start_time.sec_since_epoch());
+
+    emission.emplace(get_self(), [&](auto &_segment) {
+        _segment.start_time = start_time;
+        _segment.emission_per_period = emission_per_period.amount;
+        _segment.cumulative_emission = cumulative_emission;
+    });
+}
+
+
+/**
+* Whitelists a collection for staking and sets the units that each of its assets adds to a stake
+* Only collections with a weight can be staked. A weight of 0 removes the collection from the whitelist
+* This only applies to assets that are staked afterwards
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::setcollrate(
+    name collection_name,
+    uint64_t weight
+) {
+    require_auth(get_self());
+
+    auto collrate_itr = collrates.find(collection_name.value);
+    if (weight == 0) {
+        if (collrate_itr != collrates.end()) {
+            collrates.erase(collrate_itr);
+        }
+    } else if (collrate_itr == collrates.end()) {
+        collrates.emplace(get_self(), [&](auto &_collrate) {
+            _collrate.collection_name = collection_name;
+            _collrate.weight = weight;
+        });
+    } else {
+        collrates.modify(collrate_itr, same_payer, [&](auto &_collrate) {
+            _collrate.weight = weight;
+        });
+    }
+}
+
+
+/**
+* Sets the template attribute that weights the staked assets of a collection, e.g. their rarity
+* An asset adds its collection weight multiplied by the weight of its template's attribute value (in percent)
+* to its stake. Templates without the attribute or without a matching value, and assets without a template,
+* use default_weight. An empty attribute_name removes the rarity config of the collection
+* 
+* Like collection weights, this only applies to assets that are staked afterwards
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::setrarity(
+    name collection_name,
+    string attribute_name,
+    vector <RARITY_WEIGHT> weights,
+    uint64_t default_weight
+) {
+    require_auth(get_self());
+
+    auto rarityconf_itr = rarityconf.find(collection_name.value);
+
+    if (attribute_name.empty()) {
+        check(rarityconf_itr != rarityconf.end(), "The collection does not have a rarity config");
+        rarityconf.erase(rarityconf_itr);
+        return;
+    }
+
+    check(default_weight != 0, "The default weight must be positive");
+    for (auto weight_itr = weights.begin(); weight_itr != weights.end(); weight_itr++) {
+        check(weight_itr->weight != 0, "The weights must be positive");
+        for (auto other_weight_itr = weights.begin(); other_weight_itr != weight_itr; other_weight_itr++) {
+            check(other_weight_itr->value != weight_itr->value,
+                ("The weights contain the value " + weight_itr->value + " multiple times").c_str());
+        }
+    }
+
+    //A new id for every update, so that weights cached for an earlier config are never reused
+    uint64_t config_id = consume_counter(name("rarityconf"));
+
+    if (rarityconf_itr == rarityconf.end()) {
+        rarityconf.emplace(get_self(), [&](auto &_rarityconf) {
+            _rarityconf.collection_name = collection_name;
+            _rarityconf.attribute_name = attribute_name;
+            _rarityconf.weights = weights;
+            _rarityconf.default_weight = default_weight;
+            _rarityconf.config_id = config_id;
+        });
+    } else {
+        rarityconf.modify(rarityconf_itr, same_payer, [&](auto &_rarityconf) {
+            _rarityconf.attribute_name = attribute_name;
+            _rarityconf.weights = weights;
+            _rarityconf.default_weight = default_weight;
+            _rarityconf.config_id = config_id;
+        });
+    }
+}
+
+
+/**
+* Sets the delphioracle pair that is sampled by pokeprice
+* pokeprice fails if the newest datapoint of the pair is older than max_datapoint_age seconds, so that a
+* stalled oracle doesn't keep feeding its last price into the average
+* The price buffer is cleared, because samples of different pairs can't be averaged
+* 
+* @required_auth The contract itself
+*/
+ACTION extractor::setpricepair(
+    name delphi_pair_name,
+    uint32_t min_poke_interval,
+    uint32_t max_datapoint_age
+) {
+    require_auth(get_self());
+
+    check(delphioracle::pairs.find(delphi_pair_name.value) != delphioracle::pairs.end(),
+        "The specified delphi pair does not exist");
+    check(min_poke_interval != 0, "The minimum poke interval must be positive");
+    check(max_datapoint_age != 0, "The maximum datapoint age must be positive");
+
+    pricebuffer_s new_pricebuffer = pricebuffer_s{};
+    new_pricebuffer.delphi_pair_name = delphi_pair_name;
+    new_pricebuffer.min_poke_interval = min_poke_interval;
+    new_pricebuffer.max_datapoint_age = max_datapoint_age;
+    pricebuffer.set(new_pricebuffer, get_self());
+}
+
+
+/**
+* Samples the most recent delphioracle median of the configured pair into the price buffer
+* Only the newest oracle datapoint is read, so this is cheap enough to be called by anyone regularly
+* 
+* The buffer holds the last PRICE_BUFFER_SIZE samples. Each sample stores the cumulative price up to
+* its timestamp, which allows time weighted averages over any window covered by the buffer
+* 
+* @required_auth None
+*/
+ACTION extractor::pokeprice() {
+    check(pricebuffer.exists(), "No price pair has been set");
+    pricebuffer_s current_pricebuffer = pricebuffer.get();
+
+    uint32_t now = current_time_point().sec_since_epoch();
+
+    PRICE_SAMPLE new_sample = {
+        .timestamp = time_point_sec(now),
+        .price = 0,
+        .cumulative_price = 0
+    };
+
+    if (current_pricebuffer.samples.size() != 0) {
+        const PRICE_SAMPLE &last_sample = current_pricebuffer.samples[
+            (current_pricebuffer.next_index + current_pricebuffer.samples.size() - 1)
+            % current_pricebuffer.samples.size()];
+        check(now >= last_sample.timestamp.sec_since_epoch() + current_pricebuffer.min_poke_interval,
+            "The price has been sampled too recently");
+
+        //The price of the previous sample is assumed to have been valid until now
+        new_sample.cumulative_price = last_sample.cumulative_price + fixedpoint::checked_mul(
+            last_sample.price, now - last_sample.timestamp.sec_since_epoch());
+    }
+
+    delphioracle::datapoints_t datapoints = delphioracle::get_datapoints(current_pricebuffer.delphi_pair_name);
+    auto datapoints_by_timestamp = datapoints.get_index <name("timestamp")>();
+    auto datapoint_itr = datapoints_by_timestamp.end();
+    check(datapoint_itr != datapoints_by_timestamp.begin(), "The delphi pair does not have any datapoints");
+    datapoint_itr--;
+    check((uint64_t) datapoint_itr->timestamp.sec_since_epoch() + current_pricebuffer.max_datapoint_age >= now,
+        "The newest datapoint of the delphi pair is too old");
+    new_sample.price = datapoint_itr->median;
+
+    if (current_pricebuffer.samples.size() < PRICE_BUFFER_SIZE) {
+        current_pricebuffer.samples.push_back(new_sample);
+    } else {
+        current_pricebuffer.samples[current_pricebuffer.next_index] = new_sample;
+        current_pricebuffer.next_index = (current_pricebuffer.next_index + 1) % PRICE_BUFFER_SIZE;
+    }
+
+    pricebuffer.set(current_pricebuffer, get_self());
 }
 
 
+/**
+* Returns the time weighted average price of the configured delphi pair over the last window_seconds
+* 
+* @required_auth None
+*/
+uint64_t extractor::gettwap(
+    uint32_t window_seconds
+) {
+    return get_twap(window_seconds);
+}
 
 
 /**
@@ -109,13 +437,19 @@ ACTION extractor::claim(
 * are they in the valid collection ?
 * are they transferable?
 * is list size valid?
-* @required_auth owner
+* 
+* The asset ids are checked in ascending order, so that the owner's assets can be walked with a single
+* moving iterator, and every distinct template is only read once
+* The template ids of the assets are written to template_ids, in the order of asset_ids
 */
 name extractor::get_collection_and_check_assets(
     name owner,
-    vector <uint64_t> asset_ids
+    const vector <uint64_t> &asset_ids,
+    vector <int32_t> &template_ids
 ) {
     check(asset_ids.size() != 0, "asset_ids needs to contain at least one id");
+    check(asset_ids.size() <= MAX_ASSETS_PER_STAKE,
+        ("A stake can contain at most " + to_string(MAX_ASSETS_PER_STAKE) + " assets").c_str());
 
     vector <uint64_t> asset_ids_copy = asset_ids;
     std::sort(asset_ids_copy.begin(), asset_ids_copy.end());
@@ -124,26 +458,51 @@ name extractor::get_collection_and_check_assets(
 
 
     atomicassets::assets_t owner_assets = atomicassets::get_assets(owner);
+    auto asset_itr = owner_assets.lower_bound(asset_ids_copy.front());
+    check(asset_itr != owner_assets.end() && asset_itr->asset_id == asset_ids_copy.front(),
+        ("The specified account does not own at least one of the assets - "
+        + to_string(asset_ids_copy.front())).c_str());
+
+    name assets_collection_name = asset_itr->collection_name;
+    atomicassets::templates_t collection_templates = atomicassets::get_templates(assets_collection_name);
+    vector <int32_t> transferable_template_ids = {};
+    vector <int32_t> sorted_template_ids = {};
+    sorted_template_ids.reserve(asset_ids_copy.size());
+
+    for (auto id_itr = asset_ids_copy.begin(); id_itr != asset_ids_copy.end(); id_itr++) {
+        uint64_t asset_id = *id_itr;
+
+        if (id_itr != asset_ids_copy.begin()) {
+            //Staked assets are usually minted together, so the next owned asset is likely the next one to check
+            asset_itr++;
+            if (asset_itr != owner_assets.end() && asset_itr->asset_id < asset_id) {
+                asset_itr = owner_assets.lower_bound(asset_id);
+            }
+            check(asset_itr != owner_assets.end() && asset_itr->asset_id == asset_id,
+                ("The specified account does not own at least one of the assets - "
+                + to_string(asset_id)).c_str());
 
-    name assets_collection_name = name("");
-    for (uint64_t asset_id : asset_ids) {
-        auto asset_itr = owner_assets.require_find(asset_id,
-            ("The specified account does not own at least one of the assets - "
-            + to_string(asset_id)).c_str());
+            check(assets_collection_name == asset_itr->collection_name,
+                "The specified asset ids must all belong to the same collection");
+        }
 
-        if (asset_itr->template_id != -1) {
-            atomicassets::templates_t asset_template = atomicassets::get_templates(asset_itr->collection_name);
-            auto template_itr = asset_template.find(asset_itr->template_id);
+        if (asset_itr->template_id != -1 && std::find(transferable_template_ids.begin(),
+            transferable_template_ids.end(), asset_itr->template_id) == transferable_template_ids.end()) {
+            auto template_itr = collection_templates.require_find(asset_itr->template_id,
+                ("The template of at least one of the assets does not exist - " + to_string(asset_id)).c_str());
             check(template_itr->transferable,
                 ("At least one of the assets is not transferable - " + to_string(asset_id)).c_str());
+            transferable_template_ids.push_back(asset_itr->template_id);
         }
+        sorted_template_ids.push_back(asset_itr->template_id);
+    }
 
-        if (assets_collection_name == name("")) {
-            assets_collection_name = asset_itr->collection_name;
-        } else {
-            check(assets_collection_name == asset_itr->collection_name,
-                "The specified asset ids must all belong to the same collection");
-        }
+    template_ids.clear();
+    template_ids.reserve(asset_ids.size());
+    for (uint64_t asset_id : asset_ids) {
+        size_t sorted_position = std::lower_bound(asset_ids_copy.begin(), asset_ids_copy.end(), asset_id)
+            - asset_ids_copy.begin();
+        template_ids.push_back(sorted_template_ids[sorted_position]);
     }
 
     return assets_collection_name;
@@ -151,149 +510,825 @@ name extractor::get_collection_and_check_assets(
 
 
 /**
-* Gets the current value of a counter and increments the counter by 1
-* If no counter with the specified name exists yet, it is treated as if the counter was 1
+* Gets the position of a cursor that a batch action (e.g. sweep) has persisted between calls
+* If no cursor with the specified name exists yet, it is treated as if the position was 0
+*/
+uint64_t extractor::get_cursor(name cursor_name) {
+    auto cursor_itr = cursors.find(cursor_name.value);
+    return cursor_itr == cursors.end() ? 0 : cursor_itr->position;
+}
+
+
+/**
+* Persists the position of a cursor, so that the next call of a batch action can resume from it
+*/
+void extractor::set_cursor(name cursor_name, uint64_t position) {
+    auto cursor_itr = cursors.find(cursor_name.value);
+    if (cursor_itr == cursors.end()) {
+        cursors.emplace(get_self(), [&](auto &_cursor) {
+            _cursor.cursor_name = cursor_name;
+            _cursor.position = position;
+        });
+    } else {
+        cursors.modify(cursor_itr, same_payer, [&](auto &_cursor) {
+            _cursor.position = position;
+        });
+    }
+}
+
+
+/**
+* Gets the current value of a counter and increments the counter by one
 */
 uint64_t extractor::consume_counter(name counter_name) {
+    return reserve_counter_range(counter_name, 1).start_id;
+}
+
+
+/**
+* Reserves count consecutive ids of a counter with a single counter write
+* The ids from start_id up to (including) end_id of the returned range belong to the caller
+* If no counter with the specified name exists yet, it is treated as if the counter was 1
+*/
+extractor::COUNTER_RANGE extractor::reserve_counter_range(name counter_name, uint64_t count) {
+    check(count != 0, "At least one id needs to be reserved");
+    check_not_migrating(MIGRATION_STEP_COUNTERS);
+
     uint64_t value;
     auto counter_itr = counters.find(counter_name.value);
     if (counter_itr == counters.end()) {
         value = 1; // Starting with 1 instead of 0 because these ids can be front facing
         counters.emplace(get_self(), [&](auto &_counter) {
             _counter.counter_name = counter_name;
-            _counter.counter_value = 2;
+            _counter.counter_value = 1 + count;
         });
     } else {
         value = counter_itr->counter_value;
+        check(value + count > value, "The counter would overflow");
         counters.modify(counter_itr, get_self(), [&](auto &_counter) {
-            _counter.counter_value++;
+            _counter.counter_value += count;
         });
     }
-    return value;
+
+    return {
+        .counter_name = counter_name,
+        .start_id = value,
+        .end_id = value + count - 1
+    };
+}
+
+
+/**
+* Returns the range of ids that each counter has handed out so far
+* Counters start at 1, so every id below the current counter value has been allocated
+* Counters that have not handed out any ids yet are omitted
+* 
+* @required_auth None
+*/
+vector <extractor::COUNTER_RANGE> extractor::getcounters() {
+    vector <COUNTER_RANGE> allocated_ranges = {};
+    for (const counters_s &counter : counters) {
+        if (counter.counter_value > 1) {
+            allocated_ranges.push_back({
+                .counter_name = counter.counter_name,
+                .start_id = 1,
+                .end_id = counter.counter_value - 1
+            });
+        }
+    }
+    return allocated_ranges;
 }
 
 
 /**
-* Create a stake listing
-* For the stake to become active, the seller needs to create an atomicassets offer from them to the extractor
-* account, offering (only) the assets to be sold with the memo "stake"
+* Creates a non custodial stake. The assets stay with the owner, and the stake becomes invalid
+* as soon as the owner no longer owns one of them
+* Custodial stakes are opened with the openstake action instead
 * 
 * @required_auth owner
 */
 ACTION extractor::stake(
     name owner,
-    vector <uint64_t> asset_ids,
+    vector <uint64_t> asset_ids
 ) {
     require_auth(owner);
 
-    name assets_collection_name = get_collection_and_check_assets(owner, asset_ids);
-
-    checksum256 asset_ids_hash = hash_asset_ids(asset_ids);
-
-    auto stakes_by_hash = pool.get_index <name("assetidshash")>();
-    auto stake_itr = stakes_by_hash.find(asset_ids_hash);
-
-    while (stake_itr != stakes_by_hash.end()) {
-        if (asset_ids_hash != stake_itr->asset_ids_hash()) {
-            break;
-        }
+    vector <int32_t> template_ids;
+    name assets_collection_name = get_collection_and_check_assets(owner, asset_ids, template_ids);
 
-        check(stake_itr->owner != owner,
-            "You have already staked these assets. You can cancel the stake using the cancelstake action.");
+    rewards_s rewards_state = get_accrued_rewards();
 
-        stake_itr++;
-    }
     uint64_t stake_id = consume_counter(name("stake"));
-    pool.emplace(owner, [&](auto &_stake) {
-        _stake.stake_id = stake_id;
-        _stake.owner = owner;
-        _stake.asset_ids = asset_ids;
-        _stake.collection_name = assets_collection_name;
-    });
+    internal_create_stake(rewards_state, stake_id, owner, asset_ids, template_ids, assets_collection_name, false);
 
+    rewards.set(rewards_state, get_self());
 
-    action(
-        permission_level{get_self(), name("active")},
-        get_self(),
+
+    log_event(
         name("lognewstake"),
         make_tuple(
             stake_id,
             owner,
             asset_ids,
-            assets_collection_name,
+            assets_collection_name
         )
-    ).send();
+    );
 }
 
 
 /**
-* Cancels a stake. 
+* Creates multiple stakes at once, one for each group of asset ids
 * 
-* If the stake is invalid (the stake still owns at least one
-* of the assets on stake items, error
+* This is equivalent to calling the stake action once per group, but the stake ids are reserved as one
+* contiguous block with a single counter update and the new stakes are logged with a single lognewstakes action
 * 
-* @required_auth The stake's owner
+* @required_auth owner
 */
-ACTION extractor::unstake(
-    uint64_t stake_id
+ACTION extractor::stakemany(
+    name owner,
+    vector <vector <uint64_t>> asset_ids_groups
 ) {
-    auto stake_itr = pool.require_find(stake_id,
-        "No stake with this stake_id exists");
+    require_auth(owner);
 
-    bool is_stake_invalid = false;
+    check(asset_ids_groups.size() != 0, "asset_ids_groups needs to contain at least one group");
 
-    atomicassets::assets_t staker_assets = atomicassets::get_assets(stake_itr->owner);
-    for (uint64_t asset_id : stake_itr->asset_ids) {
-        if (staker_assets.find(asset_id) != staker_assets.end()) {
-            is_stake_invalid = true;
-            break;
-        }
+    vector <name> collection_names = {};
+    vector <vector <int32_t>> template_ids_groups(asset_ids_groups.size());
+    for (size_t i = 0; i < asset_ids_groups.size(); i++) {
+        collection_names.push_back(get_collection_and_check_assets(owner, asset_ids_groups[i], template_ids_groups[i]));
     }
-    check(is_stake_invalid ,
-        "The stake is not invalid, therefore the authorization of the staker is needed to cancel it");
-    pool.erase(stake_itr);
-}
-
 
+    rewards_s rewards_state = get_accrued_rewards();
 
-/**
-* This function is called when a transfer receipt from any token contract is sent to the extractor contract
-* It handels deposits and adds the transferred tokens to the sender's balance table row
-*/
-void extractor::receive_token_transfer(name from, name to, asset quantity, string memo) {
-    if (to != get_self()) {
-        return;
+    //Assets that are part of multiple groups are rejected by internal_create_stake, because the first
+    //group to include them has already staked them at that point
+    COUNTER_RANGE stake_ids = reserve_counter_range(name("stake"), asset_ids_groups.size());
+    for (size_t i = 0; i < asset_ids_groups.size(); i++) {
+        internal_create_stake(rewards_state, stake_ids.start_id + i, owner, asset_ids_groups[i], template_ids_groups[i],
+            collection_names[i], false);
     }
 
-    check(is_token_supported(get_first_receiver(), quantity.symbol), "The transferred token is not supported");
+    rewards.set(rewards_state, get_self());
 
-    if (memo == "claim") {
-        internal_add_balance(from, quantity);
-    } else {
-        check(false, "invalid memo");
-    }
+
+    log_event(
+        name("lognewstakes"),
+        make_tuple(
+            stake_ids.start_id,
+            owner,
+            asset_ids_groups,
+            collection_names
+        )
+    );
 }
 
 
-ACTION extractor::lognewstake(
-    uint64_t stake_id,
+/**
+* Opens a custodial stake of assets that the owner still holds
+* 
+* The stake's rows are created here and paid by the owner, because the stake is activated in the notification
+* of the atomicassets transfer, where only the contract itself could be billed for RAM. The stake earns no
+* rewards until the owner transfers exactly its assets to the contract with the memo "stake:<stake_id>".
+* Until then it is invalid as soon as the owner no longer owns one of the assets, and unstaking it only
+* releases its RAM
+* 
+* @required_auth owner
+*/
+ACTION extractor::openstake(
     name owner,
-    vector <uint64_t> asset_ids,
-    name collection_name,
+    vector <uint64_t> asset_ids
 ) {
-    require_auth(get_self());
+    require_auth(owner);
 
-    require_recipient(seller);
-}
+    vector <int32_t> template_ids;
+    name assets_collection_name = get_collection_and_check_assets(owner, asset_ids, template_ids);
 
-ACTION extractor::lognewclaim(
-    name owner,
-    vector <uint64_t> asset_ids,
-    double amount
-) {
-    require_auth(get_self());
+    rewards_s rewards_state = get_accrued_rewards();
 
-    require_recipient(owner);
+    uint64_t stake_id = consume_counter(name("stake"));
+    internal_create_stake(rewards_state, stake_id, owner, asset_ids, template_ids, assets_collection_name, true);
+
+    rewards.set(rewards_state, get_self());
+
+
+    log_event(
+        name("lognewstake"),
+        make_tuple(
+            stake_id,
+            owner,
+            asset_ids,
+            assets_collection_name
+        )
+    );
+}
+
+
+/**
+* Cancels a stake. 
+* 
+* The stake's owner can always cancel their stake.
+* Anyone else can only cancel the stake if it is invalid, meaning that the owner
+* no longer owns at least one of the staked assets. Custodial stakes can't become invalid
+* The rewards of a valid stake are settled, those of an invalid stake are forfeited
+* The assets of active custodial stakes are transferred back to the owner
+* 
+* @required_auth The stake's owner, or none if the stake is invalid
+*/
+ACTION extractor::unstake(
+    uint64_t stake_id
+) {
+    auto stake_itr = pool.require_find(stake_id,
+        "No stake with this stake_id exists");
+
+    bool valid = is_stake_valid(*stake_itr);
+    if (!has_auth(stake_itr->owner)) {
+        check(!valid,
+            "The stake is not invalid, therefore the authorization of the staker is needed to cancel it");
+    }
+
+    name owner = stake_itr->owner;
+    bool holds_assets = stake_itr->is_custodial() && !stake_itr->is_pending();
+    vector <uint64_t> asset_ids = holds_assets ? stake_itr->get_asset_ids() : vector <uint64_t>{};
+
+    rewards_s rewards_state = get_accrued_rewards();
+    internal_remove_stake(rewards_state, stake_itr, !valid);
+    rewards.set(rewards_state, get_self());
+
+    if (holds_assets) {
+        internal_transfer_assets(owner, asset_ids, "extractor Unstake");
+    }
+}
+
+
+/**
+* Adds assets to an existing, valid stake
+* The rewards the stake has accrued so far are settled first, so that the added assets only earn rewards from now on
+* 
+* @required_auth The stake's owner
+*/
+ACTION extractor::addtostake(
+    uint64_t stake_id,
+    vector <uint64_t> asset_ids
+) {
+    auto stake_itr = pool.require_find(stake_id,
+        "No stake with this stake_id exists");
+
+    require_auth(stake_itr->owner);
+
+    check(!stake_itr->is_custodial(),
+        "Assets are added to custodial stakes by transferring them with the memo stake:<stake_id>");
+    check_stake_valid(*stake_itr);
+
+    vector <int32_t> template_ids;
+    name assets_collection_name = get_collection_and_check_assets(stake_itr->owner, asset_ids, template_ids);
+    check(assets_collection_name == stake_itr->collection_name,
+        "The added assets must belong to the same collection as the stake");
+
+    rewards_s rewards_state = get_accrued_rewards();
+    internal_extend_stake(rewards_state, stake_itr, asset_ids, template_ids);
+    rewards.set(rewards_state, get_self());
+}
+
+
+/**
+* Removes assets from an existing, valid stake, without cancelling the rest of the stake
+* The rewards the stake has accrued so far, including those of the removed assets, are settled first
+* Removed assets of custodial stakes are transferred back to the owner
+* 
+* @required_auth The stake's owner
+*/
+ACTION extractor::removefromstake(
+    uint64_t stake_id,
+    vector <uint64_t> asset_ids
+) {
+    auto stake_itr = pool.require_find(stake_id,
+        "No stake with this stake_id exists");
+
+    require_auth(stake_itr->owner);
+
+    check(asset_ids.size() != 0, "asset_ids needs to contain at least one id");
+    check(!stake_itr->is_pending(), "Assets can't be removed from a custodial stake before it is activated");
+    check_stake_valid(*stake_itr);
+
+    uint64_t removed_units = 0;
+    for (uint64_t asset_id : asset_ids) {
+        auto staked_asset_itr = stakedassets.find(asset_id);
+        check(staked_asset_itr != stakedassets.end() && staked_asset_itr->stake_id == stake_id,
+            ("At least one of the assets is not part of the stake - " + to_string(asset_id)).c_str());
+        removed_units += staked_asset_itr->units;
+        //Erasing the row also rejects duplicates in asset_ids
+        stakedassets.erase(staked_asset_itr);
+    }
+
+    vector <uint64_t> stake_asset_ids = stake_itr->get_asset_ids();
+    check(stake_asset_ids.size() > asset_ids.size(),
+        "A stake can't be emptied. You can cancel the stake using the unstake action.");
+
+    vector <uint64_t> remaining_asset_ids = {};
+    for (uint64_t asset_id : stake_asset_ids) {
+        if (std::find(asset_ids.begin(), asset_ids.end(), asset_id) == asset_ids.end()) {
+            remaining_asset_ids.push_back(asset_id);
+        }
+    }
+
+    rewards_s rewards_state = get_accrued_rewards();
+
+    internal_settle_stake(rewards_state, *stake_itr);
+    pool.modify(stake_itr, same_payer, [&](auto &_stake) {
+        _stake.set_asset_ids(remaining_asset_ids);
+        _stake.units -= removed_units;
+        _stake.reward_checkpoint = rewards_state.reward_per_unit;
+    });
+
+    rewards_state.total_units -= removed_units;
+    rewards.set(rewards_state, get_self());
+
+    internal_update_collstats(stake_itr->collection_name, stake_id, -(int64_t) asset_ids.size(), 0,
+        -(int64_t) removed_units);
+
+    if (stake_itr->is_custodial()) {
+        internal_transfer_assets(stake_itr->owner, asset_ids, "extractor Unstake");
+    }
+}
+
+
+/**
+* Removes invalid stakes, walking the stakes table from where the last call stopped
+* The pending rewards of the removed stakes are forfeited
+* 
+* At most max_rows stakes are examined per call. When the end of the stakes table is reached,
+* the next call starts from the beginning again
+* The number of examined and removed stakes is reported with the logsweep action, regardless of the log mode
+* 
+* @required_auth None
+*/
+ACTION extractor::sweep(
+    uint64_t max_rows
+) {
+    check(max_rows != 0, "max_rows needs to be at least 1");
+
+    auto stake_itr = pool.lower_bound(get_cursor(name("sweep")));
+
+    rewards_s rewards_state = get_accrued_rewards();
+
+    uint64_t examined_rows = 0;
+    uint64_t reclaimed_rows = 0;
+    while (stake_itr != pool.end() && examined_rows < max_rows) {
+        examined_rows++;
+
+        if (is_stake_valid(*stake_itr)) {
+            stake_itr++;
+            continue;
+        }
+
+        uint64_t next_stake_id = stake_itr->stake_id + 1;
+        internal_remove_stake(rewards_state, stake_itr, true);
+        reclaimed_rows++;
+        stake_itr = pool.lower_bound(next_stake_id);
+    }
+
+    uint64_t next_cursor = stake_itr == pool.end() ? 0 : stake_itr->stake_id;
+    set_cursor(name("sweep"), next_cursor);
+
+    rewards.set(rewards_state, get_self());
+
+    send_log_action(
+        name("logsweep"),
+        make_tuple(
+            examined_rows,
+            reclaimed_rows,
+            next_cursor
+        )
+    );
+}
+
+
+/**
+* Settles the rewards that a stake has accrued since it was last settled
+* The rewards are added to the owner's balance and can then be withdrawn with the claim action
+* Invalid stakes can't be claimed, their rewards are forfeited when they are removed
+* 
+* @required_auth The stake's owner
+*/
+ACTION extractor::claimstake(
+    uint64_t stake_id
+) {
+    auto stake_itr = pool.require_find(stake_id,
+        "No stake with this stake_id exists");
+
+    require_auth(stake_itr->owner);
+    check_stake_valid(*stake_itr);
+
+    rewards_s rewards_state = get_accrued_rewards();
+    internal_settle_stake(rewards_state, *stake_itr);
+    pool.modify(stake_itr, same_payer, [&](auto &_stake) {
+        _stake.reward_checkpoint = rewards_state.reward_per_unit;
+    });
+    rewards.set(rewards_state, get_self());
+}
+
+
+
+/**
+* Verifies the collstats table against the stakes table, examining at most max_rows rows per call
+* 
+* The check first tallies the stakes into the statstally table, walking the stakes table from where the
+* last call stopped. Then each collection's tally is compared with its collstats row. Mismatching rows
+* are corrected and counted. Stake changes during the check are applied to the tallies as well, so the
+* check can be spread over many transactions
+* The progress is reported with the logchkstats action, regardless of the log mode. Once a check is finished,
+* the next call starts a new one
+* 
+* @required_auth None
+*/
+ACTION extractor::checkstats(
+    uint64_t max_rows
+) {
+    check(max_rows != 0, "max_rows needs to be at least 1");
+
+    statscheck_s check_state = statscheck.get_or_default(statscheck_s{});
+    if (check_state.phase == STATS_CHECK_IDLE) {
+        check_state = statscheck_s{.phase = STATS_CHECK_TALLY, .cursor = 0, .mismatched_rows = 0};
+    }
+
+    uint64_t examined_rows = 0;
+
+    if (check_state.phase == STATS_CHECK_TALLY) {
+        auto stake_itr = pool.lower_bound(check_state.cursor);
+        for (; stake_itr != pool.end() && examined_rows < max_rows; stake_itr++) {
+            examined_rows++;
+
+            auto tally_itr = statstally.find(stake_itr->collection_name.value);
+            if (tally_itr == statstally.end()) {
+                tally_itr = statstally.emplace(get_self(), [&](auto &_tally) {
+                    _tally.collection_name = stake_itr->collection_name;
+                });
+            }
+            uint64_t staked_items = stake_itr->get_asset_ids().size();
+            statstally.modify(tally_itr, same_payer, [&](auto &_tally) {
+                _tally.staked_items += staked_items;
+                _tally.stake_count++;
+                _tally.units += stake_itr->units;
+            });
+
+            check_state.cursor = stake_itr->stake_id + 1;
+        }
+
+        if (stake_itr == pool.end()) {
+            check_state.phase = STATS_CHECK_COMPARE;
+            check_state.cursor = 0;
+        }
+    }
+
+    if (check_state.phase == STATS_CHECK_COMPARE) {
+        //Collections can have a collstats row without a tally (no stakes left) and the other way around
+        //(stakes that predate the collstats table), so both tables are walked together
+        auto collstats_itr = collstats.lower_bound(check_state.cursor);
+        auto tally_itr = statstally.lower_bound(check_state.cursor);
+        while ((collstats_itr != collstats.end() || tally_itr != statstally.end()) && examined_rows < max_rows) {
+            examined_rows++;
+
+            uint64_t collection_value = std::min(
+                collstats_itr == collstats.end() ? UINT64_MAX : collstats_itr->collection_name.value,
+                tally_itr == statstally.end() ? UINT64_MAX : tally_itr->collection_name.value
+            );
+
+            statstally_s tally = statstally_s{.collection_name = name(collection_value)};
+            if (tally_itr != statstally.end() && tally_itr->collection_name.value == collection_value) {
+                tally = *tally_itr;
+                tally_itr = statstally.erase(tally_itr);
+            }
+
+            if (collstats_itr != collstats.end() && collstats_itr->collection_name.value == collection_value) {
+                if (collstats_itr->staked_items != tally.staked_items || collstats_itr->stake_count != tally.stake_count
+                    || collstats_itr->units != tally.units) {
+                    check_state.mismatched_rows++;
+                    collstats.modify(collstats_itr, same_payer, [&](auto &_collstats) {
+                        _collstats.staked_items = tally.staked_items;
+                        _collstats.stake_count = tally.stake_count;
+                        _collstats.units = tally.units;
+                    });
+                }
+                collstats_itr++;
+            } else {
+                check_state.mismatched_rows++;
+                collstats.emplace(get_self(), [&](auto &_collstats) {
+                    _collstats.collection_name = tally.collection_name;
+                    _collstats.staked_items = tally.staked_items;
+                    _collstats.stake_count = tally.stake_count;
+                    _collstats.units = tally.units;
+                });
+                collstats_itr = collstats.upper_bound(collection_value);
+            }
+
+            check_state.cursor = collection_value + 1;
+        }
+
+        if (collstats_itr == collstats.end() && tally_itr == statstally.end()) {
+            check_state.phase = STATS_CHECK_IDLE;
+            check_state.cursor = 0;
+        }
+    }
+
+    if (check_state.phase == STATS_CHECK_IDLE) {
+        statscheck.remove();
+    } else {
+        statscheck.set(check_state, get_self());
+    }
+
+
+    send_log_action(
+        name("logchkstats"),
+        make_tuple(
+            check_state.phase,
+            examined_rows,
+            check_state.mismatched_rows,
+            check_state.cursor
+        )
+    );
+}
+
+
+/**
+* Settles the accrued rewards of up to max_stakes stakes into their owners' balances, walking the stakes table
+* from where the last call stopped
+* 
+* Credits are coalesced per owner and per collection, so an owner with many stakes in the batch gets a single
+* balance write. When the end of the stakes table is reached, the next call starts from the beginning again
+* 
+* Invalid stakes are not credited. They are removed like by the sweep action, and their pending rewards are
+* forfeited. Checking a stake reads at most MAX_ASSETS_PER_STAKE assets of its owner, so the cost of a call
+* only depends on max_stakes
+* The progress is reported with the logdistrib action, regardless of the log mode, instead of one lognewclaim
+* action per stake. It includes the merged credit of every owner, so that indexers see all credited rewards
+* 
+* @required_auth None
+*/
+ACTION extractor::distribute(
+    uint64_t max_stakes
+) {
+    check(max_stakes != 0, "max_stakes needs to be at least 1");
+
+    rewards_s rewards_state = get_accrued_rewards();
+
+    vector <std::pair <name, int64_t>> owner_credits = {};
+    vector <std::pair <name, int64_t>> collection_credits = {};
+
+    auto stake_itr = pool.lower_bound(get_cursor(name("distribute")));
+    uint64_t examined_stakes = 0;
+    uint64_t removed_stakes = 0;
+    while (stake_itr != pool.end() && examined_stakes < max_stakes) {
+        examined_stakes++;
+
+        if (!is_stake_valid(*stake_itr)) {
+            uint64_t next_stake_id = stake_itr->stake_id + 1;
+            internal_remove_stake(rewards_state, stake_itr, true);
+            removed_stakes++;
+            stake_itr = pool.lower_bound(next_stake_id);
+            continue;
+        }
+
+        int64_t pending_rewards = get_pending_rewards(rewards_state, *stake_itr);
+        if (pending_rewards != 0) {
+            owner_credits.push_back({stake_itr->owner, pending_rewards});
+            collection_credits.push_back({stake_itr->collection_name, pending_rewards});
+            pool.modify(stake_itr, same_payer, [&](auto &_stake) {
+                _stake.reward_checkpoint = rewards_state.reward_per_unit;
+            });
+        }
+        stake_itr++;
+    }
+
+    uint64_t next_cursor = stake_itr == pool.end() ? 0 : stake_itr->stake_id;
+    set_cursor(name("distribute"), next_cursor);
+
+    rewards.set(rewards_state, get_self());
+
+    //Sorting groups the credits of the same owner or collection, which are then merged into one write each
+    auto merge_credits = [](vector <std::pair <name, int64_t>> &credits) {
+        std::sort(credits.begin(), credits.end());
+        vector <std::pair <name, int64_t>> merged_credits = {};
+        for (const std::pair <name, int64_t> &credit : credits) {
+            if (!merged_credits.empty() && merged_credits.back().first == credit.first) {
+                merged_credits.back().second += credit.second;
+            } else {
+                merged_credits.push_back(credit);
+            }
+        }
+        credits = merged_credits;
+    };
+    merge_credits(owner_credits);
+    merge_credits(collection_credits);
+
+    symbol reward_symbol = get_config().apoc_token.token_symbol;
+    asset distributed_quantity = asset(0, reward_symbol);
+    vector <OWNER_CREDIT> logged_credits = {};
+    logged_credits.reserve(owner_credits.size());
+    for (const std::pair <name, int64_t> &owner_credit : owner_credits) {
+        asset credited_quantity = asset(owner_credit.second, reward_symbol);
+        internal_add_balance(owner_credit.first, credited_quantity);
+        distributed_quantity += credited_quantity;
+        logged_credits.push_back(OWNER_CREDIT{.owner = owner_credit.first, .quantity = credited_quantity});
+    }
+    for (const std::pair <name, int64_t> &collection_credit : collection_credits) {
+        internal_add_settled_rewards(collection_credit.first, collection_credit.second);
+    }
+
+
+    send_log_action(
+        name("logdistrib"),
+        make_tuple(
+            examined_stakes,
+            removed_stakes,
+            logged_credits,
+            distributed_quantity,
+            next_cursor
+        )
+    );
+}
+
+
+/**
+* Returns up to limit stakes of an owner, ordered by stake id and starting at lower_stake_id
+* If there are more stakes, more is set and next_stake_id is the lower_stake_id of the next page
+* 
+* @required_auth None
+*/
+extractor::STAKES_PAGE extractor::getstakes(
+    name owner,
+    uint64_t lower_stake_id,
+    uint32_t limit
+) {
+    return get_stakes_page(pool.get_index <name("owner")>(), owner, lower_stake_id, limit);
+}
+
+
+/**
+* Returns up to limit stakes of a collection, ordered by stake id and starting at lower_stake_id
+* If there are more stakes, more is set and next_stake_id is the lower_stake_id of the next page
+* 
+* @required_auth None
+*/
+extractor::STAKES_PAGE extractor::getcollstakes(
+    name collection_name,
+    uint64_t lower_stake_id,
+    uint32_t limit
+) {
+    return get_stakes_page(pool.get_index <name("collection")>(), collection_name, lower_stake_id, limit);
+}
+
+
+/**
+* This function is called when a transfer receipt from any token contract is sent to the extractor contract
+* It handels deposits and adds the transferred tokens to the sender's balance table row
+*/
+void extractor::receive_token_transfer(name from, name to, asset quantity, string memo) {
+    if (to != get_self()) {
+        return;
+    }
+
+    check(is_token_supported(get_first_receiver(), quantity.symbol), "The transferred token is not supported");
+
+    if (memo == "claim") {
+        internal_add_balance(from, quantity);
+    } else {
+        check(false, "invalid memo");
+    }
+}
+
+
+/**
+* This function is called when an atomicassets transfer receipt is sent to the extractor contract
+* 
+* Transferring the assets of a custodial stake opened with openstake with the memo "stake:<stake_id>"
+* activates that stake. The stake's rows have been paid by the sender when opening it, so nothing
+* is billed to the contract here. The assets are held by the contract until they are unstaked
+*/
+void extractor::receive_asset_transfer(
+    name from,
+    name to,
+    vector <uint64_t> asset_ids,
+    string memo
+) {
+    if (to != get_self()) {
+        return;
+    }
+
+    if (memo.rfind("stake:", 0) == 0) {
+        uint64_t stake_id = parse_uint64(memo.substr(6), "The memo needs to be \"stake:<stake_id>\"");
+
+        auto stake_itr = pool.require_find(stake_id,
+            "No stake with this stake_id exists");
+        check(stake_itr->owner == from, "Assets can only be transferred to your own stakes");
+        check(stake_itr->is_custodial() && stake_itr->is_pending(),
+            "Assets can only be transferred to custodial stakes opened with openstake");
+
+        rewards_s rewards_state = get_accrued_rewards();
+        internal_activate_stake(rewards_state, stake_itr, asset_ids);
+        rewards.set(rewards_state, get_self());
+
+    } else {
+        check(false, "invalid memo");
+    }
+}
+
+
+ACTION extractor::lognewstake(
+    uint64_t stake_id,
+    name owner,
+    vector <uint64_t> asset_ids,
+    name collection_name
+) {
+    require_auth(get_self());
+
+    require_recipient(owner);
+}
+
+ACTION extractor::lognewstakes(
+    uint64_t first_stake_id,
+    name owner,
+    vector <vector <uint64_t>> asset_ids_groups,
+    vector <name> collection_names
+) {
+    require_auth(get_self());
+
+    require_recipient(owner);
+}
+
+ACTION extractor::logsweep(
+    uint64_t examined_rows,
+    uint64_t reclaimed_rows,
+    uint64_t next_cursor
+) {
+    require_auth(get_self());
+}
+
+ACTION extractor::logchkstats(
+    uint8_t phase,
+    uint64_t examined_rows,
+    uint64_t mismatched_rows,
+    uint64_t next_cursor
+) {
+    require_auth(get_self());
+}
+
+ACTION extractor::logdistrib(
+    uint64_t examined_stakes,
+    uint64_t removed_stakes,
+    vector <OWNER_CREDIT> owner_credits,
+    asset distributed_quantity,
+    uint64_t next_cursor
+) {
+    require_auth(get_self());
+}
+
+ACTION extractor::lognewclaim(
+    name owner,
+    vector <uint64_t> asset_ids,
+    asset amount
+) {
+    require_auth(get_self());
+
+    require_recipient(owner);
+}
+
+
+/**
+* Gets the config of the contract
+* The config singleton is only read and deserialized on the first call within an action, later calls
+* return the cached copy
+*/
+const extractor::config_s &extractor::get_config() {
+    if (!config_cache.has_value()) {
+        config_cache = config.get();
+    }
+    return *config_cache;
+}
+
+
+/**
+* Writes a modified config back to the config singleton and updates the cached copy
+*/
+void extractor::set_config(const config_s &new_config) {
+    config.set(new_config, get_self());
+    config_cache = new_config;
+}
+
+
+/**
+* Prints a packed log event to the action console in the format "<log_action>:<hex encoded data>"
+* The data can be deserialized with the ABI of the log action with the same name
+*/
+void extractor::print_event(name log_action, const vector <char> &packed_data) {
+    static const char *hex_digits = "0123456789abcdef";
+
+    string hex_data(packed_data.size() * 2, '0');
+    for (size_t i = 0; i < packed_data.size(); i++) {
+        hex_data[2 * i] = hex_digits[(uint8_t) packed_data[i] >> 4];
+        hex_data[2 * i + 1] = hex_digits[(uint8_t) packed_data[i] & 0x0F];
+    }
+
+    print(log_action, ":", hex_data, "\n");
 }
 
 
@@ -308,22 +1343,18 @@ name extractor::get_collection_author(name collection_name) {
 
 
 /**
-* Gets the token_contract corresponding to the token_symbol from the config
-* Throws if there is no supported token with the specified token_symbol
+* Gets the token_contract corresponding to the token_symbol from the token registry
+* Retired tokens are still returned, so that existing balances can be withdrawn
+* Throws if there is no registered token with the specified token_symbol
 */
 name extractor::require_get_supported_token_contract(
     symbol token_symbol
 ) {
-    config_s current_config = config.get();
+    auto token_itr = tokens.find(token_symbol.code().raw());
+    check(token_itr != tokens.end() && token_itr->token_symbol == token_symbol,
+        "The specified token symbol is not supported");
 
-    for (TOKEN supported_token : current_config.supported_tokens) {
-        if (supported_token.token_symbol == token_symbol) {
-            return supported_token.token_contract;
-        }
-    }
-
-    check(false, "The specified token symbol is not supported");
-    return name(""); //To silence the compiler warning
+    return token_itr->token_contract;
 }
 
 
@@ -334,14 +1365,11 @@ bool extractor::is_token_supported(
     name token_contract,
     symbol token_symbol
 ) {
-    config_s current_config = config.get();
-
-    for (TOKEN supported_token : current_config.supported_tokens) {
-        if (supported_token.token_contract == token_contract && supported_token.token_symbol == token_symbol) {
-            return true;
-        }
-    }
-    return false;
+    auto token_itr = tokens.find(token_symbol.code().raw());
+    return token_itr != tokens.end()
+           && token_itr->enabled
+           && token_itr->token_contract == token_contract
+           && token_itr->token_symbol == token_symbol;
 }
 
 
@@ -351,14 +1379,10 @@ bool extractor::is_token_supported(
 bool extractor::is_symbol_supported(
     symbol token_symbol
 ) {
-    config_s current_config = config.get();
-
-    for (TOKEN supported_token : current_config.supported_tokens) {
-        if (supported_token.token_symbol == token_symbol) {
-            return true;
-        }
-    }
-    return false;
+    auto token_itr = tokens.find(token_symbol.code().raw());
+    return token_itr != tokens.end()
+           && token_itr->enabled
+           && token_itr->token_symbol == token_symbol;
 }
 
 
@@ -404,38 +1428,19 @@ void extractor::internal_add_balance(
     }
     check(quantity.amount > 0, "Can't add negative balances");
 
-    auto balance_itr = balances.find(owner.value);
+    check_not_migrating(MIGRATION_STEP_ACCOUNTS);
 
-    vector <asset> quantities;
-    if (balance_itr == balances.end()) {
-        //No balance table row exists yet
-        quantities = {quantity};
-        balances.emplace(get_self(), [&](auto &_balance) {
-            _balance.owner = owner;
-            _balance.quantities = quantities;
-        });
+    accounts_t owner_accounts = get_accounts(owner);
+    auto account_itr = owner_accounts.find(quantity.symbol.code().raw());
 
+    if (account_itr == owner_accounts.end()) {
+        //The owner does not have a balance for this token yet
+        owner_accounts.emplace(get_self(), [&](auto &_account) {
+            _account.balance = quantity;
+        });
     } else {
-        //A balance table row already exists for owner
-        quantities = balance_itr->quantities;
-
-        bool found_token = false;
-        for (asset &token : quantities) {
-            if (token.symbol == quantity.symbol) {
-                //If the owner already has a balance for the token, this balance is increased
-                found_token = true;
-                token.amount += quantity.amount;
-                break;
-            }
-        }
-
-        if (!found_token) {
-            //If the owner does not already have a balance for the token, it is added to the vector
-            quantities.push_back(quantity);
-        }
-
-        balances.modify(balance_itr, get_self(), [&](auto &_balance) {
-            _balance.quantities = quantities;
+        owner_accounts.modify(account_itr, same_payer, [&](auto &_account) {
+            _account.balance += quantity;
         });
     }
 }
@@ -450,34 +1455,665 @@ void extractor::internal_decrease_balance(
     name owner,
     asset quantity
 ) {
-    auto balance_itr = balances.require_find(owner.value,
-        "The specified account does not have a balance table row");
-
-    vector <asset> quantities = balance_itr->quantities;
-    bool found_token = false;
-    for (auto itr = quantities.begin(); itr != quantities.end(); itr++) {
-        if (itr->symbol == quantity.symbol) {
-            found_token = true;
-            check(itr->amount >= quantity.amount,
-                "The specified account's balance is lower than the specified quantity");
-            itr->amount -= quantity.amount;
-            if (itr->amount == 0) {
-                quantities.erase(itr);
+    check_not_migrating(MIGRATION_STEP_ACCOUNTS);
+
+    accounts_t owner_accounts = get_accounts(owner);
+    auto account_itr = owner_accounts.require_find(quantity.symbol.code().raw(),
+        "The specified account does not have a balance for the symbol specified in the quantity");
+
+    check(account_itr->balance.symbol == quantity.symbol,
+        "The specified account does not have a balance for the symbol specified in the quantity");
+    check(account_itr->balance.amount >= quantity.amount,
+        "The specified account's balance is lower than the specified quantity");
+
+    if (account_itr->balance.amount == quantity.amount) {
+        owner_accounts.erase(account_itr);
+    } else {
+        owner_accounts.modify(account_itr, same_payer, [&](auto &_account) {
+            _account.balance -= quantity;
+        });
+    }
+}
+
+
+/**
+* Migration step that converts the now deprecated stake counter in the config singleton
+* into using the counters table
+* This is a single row, so the step always finishes in one call
+*/
+bool extractor::internal_migrate_counters(migration_s &migration_state, uint64_t max_rows) {
+    config_s current_config = get_config();
+
+    if (current_config.stake_counter != 0) {
+        auto counter_itr = counters.find(name("stake").value);
+        if (counter_itr == counters.end()) {
+            counters.emplace(get_self(), [&](auto &_counter) {
+                _counter.counter_name = name("stake");
+                _counter.counter_value = current_config.stake_counter;
+            });
+        } else {
+            counters.modify(counter_itr, same_payer, [&](auto &_counter) {
+                _counter.counter_value = std::max(_counter.counter_value, current_config.stake_counter);
+            });
+        }
+        current_config.stake_counter = 0;
+        set_config(current_config);
+        migration_state.migrated_rows++;
+    }
+
+    return true;
+}
+
+
+/**
+* Migration step that moves legacy balances rows, which hold all tokens of an account in one vector,
+* into one accounts row per account and token
+* Balances that were already credited to an accounts row are added to it
+*/
+bool extractor::internal_migrate_accounts(migration_s &migration_state, uint64_t max_rows) {
+    auto balance_itr = balances.lower_bound(migration_state.cursor);
+
+    for (uint64_t i = 0; i < max_rows && balance_itr != balances.end(); i++) {
+        accounts_t owner_accounts = get_accounts(balance_itr->owner);
+        for (const asset &quantity : balance_itr->quantities) {
+            auto account_itr = owner_accounts.find(quantity.symbol.code().raw());
+            if (account_itr == owner_accounts.end()) {
+                owner_accounts.emplace(get_self(), [&](auto &_account) {
+                    _account.balance = quantity;
+                });
+            } else {
+                owner_accounts.modify(account_itr, same_payer, [&](auto &_account) {
+                    _account.balance += quantity;
+                });
             }
-            break;
         }
+
+        migration_state.cursor = balance_itr->owner.value + 1;
+        migration_state.migrated_rows++;
+        balance_itr = balances.erase(balance_itr);
     }
-    check(found_token,
-        "The specified account does not have a balance for the symbol specified in the quantity");
 
-    //Updating the balances table
-    if (quantities.size() > 0) {
-        balances.modify(balance_itr, same_payer, [&](auto &_balance) {
-            _balance.quantities = quantities;
+    return balance_itr == balances.end();
+}
+
+
+/**
+* Fails if a migration step is currently migrating the specified table
+* The migration state is only read once per action
+*/
+void extractor::check_not_migrating(name table_name) {
+    if (!migrating_table_cache.has_value()) {
+        migrating_table_cache = migration.exists() ? migration.get().step : name();
+    }
+    check(*migrating_table_cache != table_name,
+        ("The " + table_name.to_string() + " table is being migrated, try again later").c_str());
+}
+
+
+/**
+* Gets the time weighted average price of the configured delphi pair over the last window_seconds
+* 
+* The cumulative price at the start of the window is interpolated from the last sample before it, which is
+* found with a binary search over the fixed size buffer. This does not read any oracle tables
+* Throws if the buffer does not cover the whole window
+*/
+uint64_t extractor::get_twap(uint32_t window_seconds) {
+    check(window_seconds != 0, "The window must be positive");
+    check(pricebuffer.exists(), "No price pair has been set");
+    pricebuffer_s current_pricebuffer = pricebuffer.get();
+
+    const vector <PRICE_SAMPLE> &samples = current_pricebuffer.samples;
+    check(samples.size() != 0, "The price has not been sampled yet");
+
+    //Once the buffer is full, the oldest sample is the one that will be overwritten next
+    uint64_t oldest_index = samples.size() < PRICE_BUFFER_SIZE ? 0 : current_pricebuffer.next_index;
+    auto sample_at = [&](uint64_t chronological_index) -> const PRICE_SAMPLE & {
+        return samples[(oldest_index + chronological_index) % samples.size()];
+    };
+
+    uint32_t now = current_time_point().sec_since_epoch();
+    check(window_seconds <= now, "The window is too large");
+    uint32_t window_start = now - window_seconds;
+
+    check(sample_at(0).timestamp.sec_since_epoch() <= window_start,
+        "The price buffer does not cover the requested window");
+
+    //Binary search for the last sample at or before the start of the window
+    uint64_t low = 0;
+    uint64_t high = samples.size() - 1;
+    while (low < high) {
+        uint64_t middle = (low + high + 1) / 2;
+        if (sample_at(middle).timestamp.sec_since_epoch() <= window_start) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    const PRICE_SAMPLE &start_sample = sample_at(low);
+    const PRICE_SAMPLE &newest_sample = sample_at(samples.size() - 1);
+
+    uint128_t cumulative_at_start = start_sample.cumulative_price + fixedpoint::checked_mul(
+        start_sample.price, window_start - start_sample.timestamp.sec_since_epoch());
+    uint128_t cumulative_at_now = newest_sample.cumulative_price + fixedpoint::checked_mul(
+        newest_sample.price, now - newest_sample.timestamp.sec_since_epoch());
+
+    return fixedpoint::to_uint64(fixedpoint::div(cumulative_at_now - cumulative_at_start, window_seconds));
+}
+
+
+/**
+* Gets the total emission of the emission schedule up to the specified time, multiplied by the length of
+* an accrual period
+* 
+* The emission between two points in time is the difference of their cumulative emissions. This is computed
+* in closed form with a single lookup of the segment containing the time, regardless of how many segments
+* or accrual periods lie in between
+*/
+uint128_t extractor::get_cumulative_emission(uint32_t time) {
+    auto segment_itr = emission.upper_bound(time);
+    if (segment_itr == emission.begin()) {
+        return 0;
+    }
+    segment_itr--;
+
+    return segment_itr->cumulative_emission + fixedpoint::checked_mul(
+        segment_itr->emission_per_period, time - segment_itr->start_time.sec_since_epoch());
+}
+
+
+/**
+* Gets the units that each staked asset of a collection adds to its stake
+* Collections that are not whitelisted with setcollrate have a weight of 0
+*/
+uint64_t extractor::get_collection_weight(name collection_name) {
+    auto collrate_itr = collrates.find(collection_name.value);
+    return collrate_itr == collrates.end() ? 0 : collrate_itr->weight;
+}
+
+
+/**
+* Gets the weight of a template according to the rarity config of its collection
+* 
+* Weights are cached in the tmplweights table, because template data never changes. On a cache miss, the
+* template and its schema are read and only the configured attribute is decoded from the serialized data
+* A new cache row is paid by payer, who needs to have authorized the action
+*/
+uint64_t extractor::get_template_weight(const rarityconf_s &collection_rarityconf, int32_t template_id, name payer) {
+    tmplweights_t collection_tmplweights = get_tmplweights(collection_rarityconf.collection_name);
+    auto tmplweight_itr = collection_tmplweights.find((uint64_t) template_id);
+    if (tmplweight_itr != collection_tmplweights.end()
+        && tmplweight_itr->config_id == collection_rarityconf.config_id) {
+        return tmplweight_itr->weight;
+    }
+
+    auto template_itr = atomicassets::get_templates(collection_rarityconf.collection_name).require_find(
+        (uint64_t) template_id, "Internal error: The template of a staked asset does not exist");
+    auto schema_itr = atomicassets::get_schemas(collection_rarityconf.collection_name).require_find(
+        template_itr->schema_name.value, "Internal error: The schema of a template does not exist");
+
+    uint64_t weight = collection_rarityconf.default_weight;
+    atomicdata::ATTRIBUTE_VIEW attribute = atomicdata::find_attribute(
+        template_itr->immutable_serialized_data, schema_itr->format, collection_rarityconf.attribute_name);
+    if (attribute.found) {
+        string value = atomicdata::attribute_to_string(template_itr->immutable_serialized_data, attribute);
+        for (const RARITY_WEIGHT &rarity_weight : collection_rarityconf.weights) {
+            if (rarity_weight.value == value) {
+                weight = rarity_weight.weight;
+                break;
+            }
+        }
+    }
+
+    if (tmplweight_itr == collection_tmplweights.end()) {
+        collection_tmplweights.emplace(payer, [&](auto &_tmplweight) {
+            _tmplweight.template_id = template_id;
+            _tmplweight.weight = weight;
+            _tmplweight.config_id = collection_rarityconf.config_id;
+        });
+    } else {
+        collection_tmplweights.modify(tmplweight_itr, same_payer, [&](auto &_tmplweight) {
+            _tmplweight.weight = weight;
+            _tmplweight.config_id = collection_rarityconf.config_id;
+        });
+    }
+
+    return weight;
+}
+
+
+/**
+* Gets the units that each asset adds to a stake, in the order of template_ids
+* This is the collection weight, multiplied by the template weight (in percent) if the collection has a rarity config
+* Fails if the collection is not whitelisted. Template weights that are not cached yet are cached at the
+* expense of payer
+*/
+vector <uint64_t> extractor::get_asset_units(name collection_name, const vector <int32_t> &template_ids, name payer) {
+    uint64_t collection_weight = get_collection_weight(collection_name);
+    check(collection_weight != 0,
+        ("The collection " + collection_name.to_string() + " is not whitelisted for staking").c_str());
+    auto rarityconf_itr = rarityconf.find(collection_name.value);
+
+    vector <uint64_t> asset_units = {};
+    asset_units.reserve(template_ids.size());
+
+    if (rarityconf_itr == rarityconf.end()) {
+        asset_units.resize(template_ids.size(), collection_weight);
+        return asset_units;
+    }
+
+    //Assets of the same template are usually staked together, so each distinct template is only resolved once
+    vector <std::pair <int32_t, uint64_t>> template_weights = {};
+    for (int32_t template_id : template_ids) {
+        uint64_t template_weight = rarityconf_itr->default_weight;
+        if (template_id != -1) {
+            auto template_weight_itr = std::find_if(template_weights.begin(), template_weights.end(),
+                [&](const std::pair <int32_t, uint64_t> &resolved) { return resolved.first == template_id; });
+            if (template_weight_itr != template_weights.end()) {
+                template_weight = template_weight_itr->second;
+            } else {
+                template_weight = get_template_weight(*rarityconf_itr, template_id, payer);
+                template_weights.push_back({template_id, template_weight});
+            }
+        }
+
+        asset_units.push_back(fixedpoint::to_uint64(fixedpoint::mul_div(
+            collection_weight, template_weight, DEFAULT_TEMPLATE_WEIGHT)));
+    }
+
+    return asset_units;
+}
+
+
+/**
+* Loads the rewards singleton and accrues the emission since the last accrual, up to the current second,
+* into the reward per unit accumulator
+* 
+* Accruing up to now rather than up to the last full period means that a stake created mid period is
+* checkpointed at the current reward per unit, so it can't claim emission from before it was created.
+* This takes constant time regardless of the number of stakes and of the time since the last accrual.
+* Callers are responsible for writing the returned state back to the rewards singleton
+*/
+extractor::rewards_s extractor::get_accrued_rewards() {
+    rewards_s rewards_state = rewards.get_or_default(rewards_s{});
+
+    uint32_t accrual_period = get_config().minimum_calc_duaration * 60;
+    uint32_t now = current_time_point().sec_since_epoch();
+
+    if (rewards_state.last_accrual == time_point_sec(0)) {
+        rewards_state.last_accrual = time_point_sec(now);
+        rewards_state.last_cumulative_emission = get_cumulative_emission(now);
+        return rewards_state;
+    }
+
+    if (now <= rewards_state.last_accrual.sec_since_epoch()) {
+        return rewards_state;
+    }
+
+    uint128_t cumulative_emission = get_cumulative_emission(now);
+
+    //If nothing is staked, the emission since the last accrual is not distributed to anyone
+    //Rounding down guarantees that no more than the emission is ever paid out
+    if (rewards_state.total_units != 0) {
+        rewards_state.reward_per_unit += fixedpoint::mul_div(
+            cumulative_emission - rewards_state.last_cumulative_emission,
+            REWARD_PRECISION,
+            fixedpoint::checked_mul(accrual_period, rewards_state.total_units)
+        );
+    }
+    rewards_state.last_accrual = time_point_sec(now);
+    rewards_state.last_cumulative_emission = cumulative_emission;
+
+    return rewards_state;
+}
+
+
+/**
+* Gets the rewards a stake has accrued since its last checkpoint, in the smallest unit of the apoc token
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+*/
+int64_t extractor::get_pending_rewards(
+    const rewards_s &rewards_state,
+    const stake_s &stake
+) {
+    return fixedpoint::to_amount(fixedpoint::mul_div(
+        rewards_state.reward_per_unit - stake.reward_checkpoint,
+        stake.units,
+        REWARD_PRECISION
+    ));
+}
+
+
+/**
+* Internal function to settle the rewards a stake has accrued since its last checkpoint
+* The settled amount is added to the owner's balance and reported with the lognewclaim action
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+* If the stake is kept, the caller needs to move its reward_checkpoint to rewards_state.reward_per_unit
+*/
+void extractor::internal_settle_stake(
+    const rewards_s &rewards_state,
+    const stake_s &stake
+) {
+    asset settled_quantity = asset(
+        get_pending_rewards(rewards_state, stake),
+        get_config().apoc_token.token_symbol
+    );
+    if (settled_quantity.amount == 0) {
+        return;
+    }
+
+    internal_add_balance(stake.owner, settled_quantity);
+    internal_add_settled_rewards(stake.collection_name, settled_quantity.amount);
+
+    log_event(
+        name("lognewclaim"),
+        make_tuple(
+            stake.owner,
+            stake.get_asset_ids(),
+            settled_quantity
+        )
+    );
+}
+
+
+/**
+* Internal function to add settled rewards to the collstats row of a collection
+*/
+void extractor::internal_add_settled_rewards(
+    name collection_name,
+    int64_t amount
+) {
+    auto collstats_itr = collstats.find(collection_name.value);
+    if (collstats_itr == collstats.end()) {
+        collstats.emplace(get_self(), [&](auto &_collstats) {
+            _collstats.collection_name = collection_name;
+            _collstats.rewards_settled = amount;
         });
     } else {
-        balances.erase(balance_itr);
+        collstats.modify(collstats_itr, same_payer, [&](auto &_collstats) {
+            _collstats.rewards_settled += amount;
+        });
+    }
+}
+
+
+/**
+* Checks whether the owner of a stake still owns all of its assets
+* The assets of active custodial stakes are held by the contract, so these are always valid
+*/
+bool extractor::is_stake_valid(
+    const stake_s &stake
+) {
+    if (stake.is_custodial() && !stake.is_pending()) {
+        return true;
+    }
+
+    atomicassets::assets_t staker_assets = atomicassets::get_assets(stake.owner);
+    for (uint64_t asset_id : stake.get_asset_ids()) {
+        if (staker_assets.find(asset_id) == staker_assets.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+* Fails if the owner of a stake no longer owns all of its assets
+*/
+void extractor::check_stake_valid(
+    const stake_s &stake
+) {
+    check(is_stake_valid(stake),
+        "The stake is invalid, because its owner no longer owns all of its assets. It can only be unstaked");
+}
+
+
+/**
+* Internal function to create a stake with an already reserved stake id
+* The assets need to have been checked with get_collection_and_check_assets before, and the rows are paid by
+* the owner. Custodial stakes are created pending with 0 units, their asset units are stored in the
+* stakedassets table and only added to the stake once it is activated
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+*/
+void extractor::internal_create_stake(
+    rewards_s &rewards_state,
+    uint64_t stake_id,
+    name owner,
+    const vector <uint64_t> &asset_ids,
+    const vector <int32_t> &template_ids,
+    name collection_name,
+    bool custodial
+) {
+    vector <uint64_t> asset_units = get_asset_units(collection_name, template_ids, owner);
+    uint64_t stake_units = 0;
+    for (uint64_t units : asset_units) {
+        stake_units += units;
+    }
+
+    if (custodial) {
+        stake_units = 0;
+    }
+
+    internal_add_staked_assets(rewards_state, stake_id, owner, asset_ids, asset_units);
+
+    pool.emplace(owner, [&](auto &_stake) {
+        _stake.stake_id = stake_id;
+        _stake.owner = owner;
+        _stake.collection_name = collection_name;
+        _stake.set_asset_ids(asset_ids);
+        _stake.units = stake_units;
+        _stake.reward_checkpoint = rewards_state.reward_per_unit;
+        _stake.custodial = custodial;
+        if (custodial) {
+            _stake.pending = true;
+        }
+    });
+
+    rewards_state.total_units += stake_units;
+    internal_update_collstats(collection_name, stake_id, asset_ids.size(), 1, stake_units);
+}
+
+
+/**
+* Internal function to add assets to an existing stake
+* The assets need to have been checked with get_collection_and_check_assets before and belong to the
+* collection of the stake. The rewards the stake has accrued so far are settled first,
+* so that the added assets only earn rewards from now on
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+*/
+void extractor::internal_extend_stake(
+    rewards_s &rewards_state,
+    stake_t::const_iterator stake_itr,
+    const vector <uint64_t> &asset_ids,
+    const vector <int32_t> &template_ids
+) {
+    vector <uint64_t> stake_asset_ids = stake_itr->get_asset_ids();
+    check(stake_asset_ids.size() + asset_ids.size() <= MAX_ASSETS_PER_STAKE,
+        ("A stake can contain at most " + to_string(MAX_ASSETS_PER_STAKE) + " assets").c_str());
+    stake_asset_ids.insert(stake_asset_ids.end(), asset_ids.begin(), asset_ids.end());
+
+    vector <uint64_t> asset_units = get_asset_units(stake_itr->collection_name, template_ids, stake_itr->owner);
+    uint64_t added_units = 0;
+    for (uint64_t units : asset_units) {
+        added_units += units;
+    }
+
+    //Assets that are already part of this stake are rejected here, because the stake has the same owner
+    internal_add_staked_assets(rewards_state, stake_itr->stake_id, stake_itr->owner, asset_ids, asset_units);
+
+    internal_settle_stake(rewards_state, *stake_itr);
+    pool.modify(stake_itr, same_payer, [&](auto &_stake) {
+        _stake.set_asset_ids(stake_asset_ids);
+        _stake.units += added_units;
+        _stake.reward_checkpoint = rewards_state.reward_per_unit;
+    });
+
+    rewards_state.total_units += added_units;
+    internal_update_collstats(stake_itr->collection_name, stake_itr->stake_id, asset_ids.size(), 0, added_units);
+}
+
+
+/**
+* Internal function to add assets to the stakedassets reverse index, pointing to the stake with the
+* specified stake id, each adding the units at the same position in asset_units to it
+* 
+* An asset can only be part of one stake. The owner needs to have been verified to own all assets before,
+* so a stake of another account that still contains one of them has become invalid and is removed.
+* The pending rewards of removed stakes are forfeited, like when they are swept
+* The rows are paid by the owner
+*/
+void extractor::internal_add_staked_assets(
+    rewards_s &rewards_state,
+    uint64_t stake_id,
+    name owner,
+    const vector <uint64_t> &asset_ids,
+    const vector <uint64_t> &asset_units
+) {
+    for (size_t i = 0; i < asset_ids.size(); i++) {
+        uint64_t asset_id = asset_ids[i];
+        auto staked_asset_itr = stakedassets.find(asset_id);
+        if (staked_asset_itr != stakedassets.end()) {
+            auto other_stake_itr = pool.require_find(staked_asset_itr->stake_id,
+                "Internal error: The stake of a staked asset does not exist");
+            check(other_stake_itr->owner != owner,
+                ("You have already staked at least one of the assets - " + to_string(asset_id)
+                + ". You can cancel the stake using the unstake action.").c_str());
+            internal_remove_stake(rewards_state, other_stake_itr, true);
+        }
+
+        stakedassets.emplace(owner, [&](auto &_staked_asset) {
+            _staked_asset.asset_id = asset_id;
+            _staked_asset.stake_id = stake_id;
+            _staked_asset.units = asset_units[i];
+        });
+    }
+}
+
+
+/**
+* Internal function to activate a custodial stake opened with openstake, once its assets have been
+* transferred to the contract
+* The stake gets the units that were stored for its assets when it was opened, and earns rewards from now on.
+* Only fixed size fields are modified, so the RAM paid by the owner covers the stake's rows
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+*/
+void extractor::internal_activate_stake(
+    rewards_s &rewards_state,
+    stake_t::const_iterator stake_itr,
+    const vector <uint64_t> &asset_ids
+) {
+    //The encoding is canonical, so the packed ids are equal if the transfer contains exactly the stake's assets
+    check(pack_asset_ids(asset_ids) == stake_itr->packed_asset_ids,
+        "The transferred assets need to be exactly the assets of the stake");
+
+    uint64_t stake_units = 0;
+    for (uint64_t asset_id : stake_itr->get_asset_ids()) {
+        stake_units += stakedassets.get(asset_id,
+            "Internal error: A staked asset is missing from the stakedassets table").units;
+    }
+
+    pool.modify(stake_itr, same_payer, [&](auto &_stake) {
+        _stake.units = stake_units;
+        _stake.reward_checkpoint = rewards_state.reward_per_unit;
+        _stake.pending = false;
+    });
+
+    rewards_state.total_units += stake_units;
+    internal_update_collstats(stake_itr->collection_name, stake_itr->stake_id, 0, 0, stake_units);
+}
+
+
+/**
+* Internal function to remove a stake
+* The stake's rewards are settled, unless they are forfeited because the stake is invalid. Its units are
+* removed from the total and its assets are removed from the stakedassets reverse index
+* Forfeited rewards stay with the contract and are not distributed to other stakes
+* 
+* rewards_state needs to be accrued up to the current time before calling this
+*/
+void extractor::internal_remove_stake(
+    rewards_s &rewards_state,
+    stake_t::const_iterator stake_itr,
+    bool forfeit_rewards
+) {
+    if (!forfeit_rewards) {
+        internal_settle_stake(rewards_state, *stake_itr);
+    }
+    rewards_state.total_units -= stake_itr->units;
+
+    vector <uint64_t> asset_ids = stake_itr->get_asset_ids();
+    for (uint64_t asset_id : asset_ids) {
+        stakedassets.erase(stakedassets.require_find(asset_id,
+            "Internal error: A staked asset is missing from the stakedassets table"));
+    }
+
+    internal_update_collstats(stake_itr->collection_name, stake_itr->stake_id, -(int64_t) asset_ids.size(), -1,
+        -(int64_t) stake_itr->units);
+
+    pool.erase(stake_itr);
+}
+
+
+/**
+* Internal function to apply a change of the stakes of a collection to its collstats row
+* 
+* Stakes that existed before the collstats table was introduced are only counted after the first full
+* checkstats run, so the aggregates saturate at 0 instead of failing the stake change
+* While checkstats is running, changes to stakes that it has already tallied are applied to the tally as well
+*/
+void extractor::internal_update_collstats(
+    name collection_name,
+    uint64_t stake_id,
+    int64_t staked_items_delta,
+    int64_t stake_count_delta,
+    int64_t units_delta
+) {
+    auto apply_delta = [](uint64_t &value, int64_t delta) {
+        if (delta < 0 && (uint64_t) -delta > value) {
+            value = 0;
+        } else {
+            value += delta;
+        }
+    };
+
+    auto collstats_itr = collstats.find(collection_name.value);
+    if (collstats_itr == collstats.end()) {
+        collstats_itr = collstats.emplace(get_self(), [&](auto &_collstats) {
+            _collstats.collection_name = collection_name;
+        });
+    }
+    collstats.modify(collstats_itr, same_payer, [&](auto &_collstats) {
+        apply_delta(_collstats.staked_items, staked_items_delta);
+        apply_delta(_collstats.stake_count, stake_count_delta);
+        apply_delta(_collstats.units, units_delta);
+    });
+
+    if (!statscheck_cache.has_value()) {
+        statscheck_cache = statscheck.get_or_default(statscheck_s{});
+    }
+    bool tallied = (statscheck_cache->phase == STATS_CHECK_TALLY && stake_id < statscheck_cache->cursor)
+        || (statscheck_cache->phase == STATS_CHECK_COMPARE && collection_name.value >= statscheck_cache->cursor);
+    if (!tallied) {
+        return;
     }
+
+    auto tally_itr = statstally.find(collection_name.value);
+    if (tally_itr == statstally.end()) {
+        tally_itr = statstally.emplace(get_self(), [&](auto &_tally) {
+            _tally.collection_name = collection_name;
+        });
+    }
+    statstally.modify(tally_itr, same_payer, [&](auto &_tally) {
+        apply_delta(_tally.staked_items, staked_items_delta);
+        apply_delta(_tally.stake_count, stake_count_delta);
+        apply_delta(_tally.units, units_delta);
+    });
 }
 
 
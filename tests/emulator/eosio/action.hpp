@@ -0,0 +1,63 @@
+/*
+
+Host emulation of eosio actions and of the authorization and notification intrinsics.
+
+Sent inline actions are serialized and recorded in the chain state in the order in which they were sent.
+The test harness applies them after the sending action, like the chain does.
+
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "check.hpp"
+#include "datastream.hpp"
+#include "emulator.hpp"
+#include "name.hpp"
+
+namespace eosio {
+    struct action {
+        eosio::name                    account;
+        eosio::name                    name;
+        std::vector <permission_level> authorization;
+        std::vector <char>             data;
+
+        template <typename T>
+        action(const permission_level &auth, eosio::name a, eosio::name n, const T &value)
+            : account(a), name(n), authorization({auth}), data(pack(value)) {}
+
+        template <typename T>
+        action(const std::vector <permission_level> &auths, eosio::name a, eosio::name n, const T &value)
+            : account(a), name(n), authorization(auths), data(pack(value)) {}
+
+        void send() const {
+            for (const permission_level &auth : authorization) {
+                check(!emulator::state().in_action || auth.actor == emulator::state().receiver
+                      || emulator::state().authorizations.count(auth.actor) != 0,
+                    "missing authority of " + auth.actor.to_string());
+            }
+            emulator::state().sent_actions.push_back({account, name, authorization, data});
+        }
+    };
+
+
+    inline bool has_auth(name n) {
+        return emulator::state().authorizations.count(n) != 0;
+    }
+
+    inline void require_auth(name n) {
+        check(has_auth(n), "missing authority of " + n.to_string());
+    }
+
+    inline void require_recipient(name notify_account) {
+        emulator::state().recipients.push_back(notify_account);
+    }
+
+    inline bool is_account(name n) {
+        return n.value != 0;
+    }
+
+    template <typename T>
+    void set_action_return_value(T &&) {}
+}
@@ -0,0 +1,106 @@
+/*
+
+Host emulation of eosio::asset, with the same range and symbol checks as the CDT.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "check.hpp"
+#include "symbol.hpp"
+
+namespace eosio {
+    struct asset {
+        static constexpr int64_t max_amount = (1LL << 62) - 1;
+
+        int64_t amount = 0;
+        eosio::symbol symbol;
+
+        asset() = default;
+
+        asset(int64_t a, eosio::symbol s) : amount(a), symbol(s) {
+            check(is_amount_within_range(), "magnitude of asset amount must be less than 2^62");
+            check(symbol.is_valid(), "invalid symbol name");
+        }
+
+        bool is_amount_within_range() const { return -max_amount <= amount && amount <= max_amount; }
+
+        bool is_valid() const { return is_amount_within_range() && symbol.is_valid(); }
+
+        std::string to_string() const {
+            bool negative = amount < 0;
+            uint64_t abs_amount = negative ? -(uint64_t) amount : (uint64_t) amount;
+            std::string digits = std::to_string(abs_amount);
+
+            uint8_t precision = symbol.precision();
+            if (precision != 0) {
+                if (digits.size() <= precision) {
+                    digits.insert(0, precision + 1 - digits.size(), '0');
+                }
+                digits.insert(digits.size() - precision, ".");
+            }
+            return (negative ? "-" : "") + digits + " " + symbol.code().to_string();
+        }
+
+        asset &operator+=(const asset &a) {
+            check(a.symbol == symbol, "attempt to add asset with different symbol");
+            amount += a.amount;
+            check(-max_amount <= amount, "addition underflow");
+            check(amount <= max_amount, "addition overflow");
+            return *this;
+        }
+
+        asset &operator-=(const asset &a) {
+            check(a.symbol == symbol, "attempt to subtract asset with different symbol");
+            amount -= a.amount;
+            check(-max_amount <= amount, "subtraction underflow");
+            check(amount <= max_amount, "subtraction overflow");
+            return *this;
+        }
+
+        asset operator-() const {
+            asset r = *this;
+            r.amount = -r.amount;
+            return r;
+        }
+
+        friend asset operator+(const asset &a, const asset &b) {
+            asset result = a;
+            result += b;
+            return result;
+        }
+
+        friend asset operator-(const asset &a, const asset &b) {
+            asset result = a;
+            result -= b;
+            return result;
+        }
+
+        friend bool operator==(const asset &a, const asset &b) {
+            check(a.symbol == b.symbol, "comparison of assets with different symbols is not allowed");
+            return a.amount == b.amount;
+        }
+
+        friend bool operator!=(const asset &a, const asset &b) { return !(a == b); }
+
+        friend bool operator<(const asset &a, const asset &b) {
+            check(a.symbol == b.symbol, "comparison of assets with different symbols is not allowed");
+            return a.amount < b.amount;
+        }
+
+        friend bool operator<=(const asset &a, const asset &b) { return !(b < a); }
+
+        friend bool operator>(const asset &a, const asset &b) { return b < a; }
+
+        friend bool operator>=(const asset &a, const asset &b) { return !(a < b); }
+    };
+
+
+    struct extended_asset {
+        asset quantity;
+        name  contract;
+    };
+}
@@ -0,0 +1,56 @@
+/*
+
+Host emulation of eosio::binary_extension. A field that is not set is not serialized at all, so rows
+written before the field was appended to a table still deserialize.
+
+*/
+
+#pragma once
+
+#include <optional>
+
+#include "check.hpp"
+
+namespace eosio {
+    template <typename T>
+    class binary_extension {
+    public:
+        using value_type = T;
+
+        constexpr binary_extension() = default;
+
+        constexpr binary_extension(const T &ext) : _value(ext) {}
+
+        constexpr bool has_value() const { return _value.has_value(); }
+
+        constexpr const T &value() const {
+            check(has_value(), "cannot get value of empty binary_extension");
+            return *_value;
+        }
+
+        constexpr T &value() {
+            check(has_value(), "cannot get value of empty binary_extension");
+            return *_value;
+        }
+
+        constexpr T value_or(const T &def = T()) const { return _value.value_or(def); }
+
+        constexpr const T &operator*() const { return value(); }
+
+        constexpr T &operator*() { return value(); }
+
+        constexpr const T *operator->() const { return &value(); }
+
+        constexpr T *operator->() { return &value(); }
+
+        template <typename... Args>
+        T &emplace(Args &&... args) {
+            return _value.emplace(std::forward<Args>(args)...);
+        }
+
+        void reset() { _value.reset(); }
+
+    private:
+        std::optional <T> _value;
+    };
+}
@@ -0,0 +1,33 @@
+/*
+
+Host emulation of the eosio CDT check functions.
+
+On chain a failing check aborts the transaction. On the host it throws an assertion_failure, which
+the test harness catches to roll back the emulated transaction.
+
+*/
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+namespace eosio {
+    namespace emulator {
+        struct assertion_failure : std::runtime_error {
+            using std::runtime_error::runtime_error;
+        };
+    }
+
+    inline void check(bool pred, const char *msg) {
+        if (!pred) {
+            throw emulator::assertion_failure(msg);
+        }
+    }
+
+    inline void check(bool pred, const std::string &msg) {
+        if (!pred) {
+            throw emulator::assertion_failure(msg);
+        }
+    }
+}
@@ -0,0 +1,369 @@
+/*
+
+Host emulation of the eosio CDT serialization.
+
+Values are serialized in the same binary format as on chain: integers little endian, lengths as varuint32,
+binary extensions only when set. The CDT reflects the fields of tables and structs automatically. On the
+host, the fields of every struct that is serialized need to be listed once with EOSIO_EMULATOR_REFLECT,
+in declaration order.
+
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "asset.hpp"
+#include "binary_extension.hpp"
+#include "check.hpp"
+#include "name.hpp"
+#include "symbol.hpp"
+#include "time.hpp"
+
+typedef unsigned __int128 uint128_t;
+typedef __int128 int128_t;
+
+namespace eosio {
+    /**
+    * Lists the fields of a struct for serialization, specialized with EOSIO_EMULATOR_REFLECT
+    */
+    template <typename T>
+    struct reflector {
+        static constexpr bool is_reflected = false;
+    };
+
+
+    struct unsigned_int {
+        uint32_t value = 0;
+
+        unsigned_int(uint32_t v = 0) : value(v) {}
+
+        operator uint32_t() const { return value; }
+    };
+
+
+    template <typename T>
+    class datastream {
+    public:
+        datastream(T start, size_t size) : _start(start), _pos(start), _end(start + size) {}
+
+        void write(const void *data, size_t size) {
+            check(size <= remaining(), "datastream attempted to write past the end");
+            memcpy(_pos, data, size);
+            _pos += size;
+        }
+
+        void read(void *data, size_t size) {
+            check(size <= remaining(), "datastream attempted to read past the end");
+            memcpy(data, _pos, size);
+            _pos += size;
+        }
+
+        size_t remaining() const { return _end - _pos; }
+
+        size_t tellp() const { return _pos - _start; }
+
+    private:
+        T _start;
+        T _pos;
+        T _end;
+    };
+
+
+    /**
+    * Datastream that only counts the bytes written to it
+    */
+    template <>
+    class datastream <size_t> {
+    public:
+        datastream(size_t init_size = 0) : _size(init_size) {}
+
+        void write(const void *, size_t size) { _size += size; }
+
+        size_t remaining() const { return 0; }
+
+        size_t tellp() const { return _size; }
+
+    private:
+        size_t _size;
+    };
+
+
+    namespace emulator {
+        template <typename T, template <typename...> class Template>
+        struct is_specialization : std::false_type {};
+
+        template <template <typename...> class Template, typename... Args>
+        struct is_specialization <Template <Args...>, Template> : std::true_type {};
+
+        template <typename T>
+        struct is_std_array : std::false_type {};
+
+        template <typename T, size_t N>
+        struct is_std_array <std::array <T, N>> : std::true_type {};
+
+        template <typename T>
+        inline constexpr bool dependent_false = false;
+
+        template <typename T>
+        inline constexpr bool is_byte = std::is_same_v <T, char> || std::is_same_v <T, int8_t>
+                                        || std::is_same_v <T, uint8_t>;
+
+
+        template <typename Stream>
+        void write_varuint32(Stream &ds, uint64_t value) {
+            do {
+                uint8_t byte = (uint8_t) (value & 0x7F);
+                value >>= 7;
+                byte |= (uint8_t) ((value > 0) << 7);
+                ds.write(&byte, 1);
+            } while (value);
+        }
+
+        template <typename Stream>
+        uint32_t read_varuint32(Stream &ds) {
+            uint64_t value = 0;
+            uint8_t byte;
+            uint8_t shift = 0;
+            do {
+                check(shift < 35, "varuint32 is too long");
+                ds.read(&byte, 1);
+                value |= (uint64_t) (byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            return (uint32_t) value;
+        }
+
+
+        template <typename Stream, typename T>
+        void write_value(Stream &ds, const T &value);
+
+        template <typename Stream, typename T>
+        void read_value(Stream &ds, T &value);
+
+        template <typename Stream, typename Variant, size_t... Indexes>
+        void read_variant_alternative(Stream &ds, Variant &value, uint32_t index, std::index_sequence <Indexes...>);
+
+
+        template <typename Stream, typename T>
+        void write_value(Stream &ds, const T &value) {
+            if constexpr (std::is_same_v <T, bool>) {
+                uint8_t byte = value ? 1 : 0;
+                ds.write(&byte, 1);
+            } else if constexpr (std::is_arithmetic_v <T> || std::is_enum_v <T> || std::is_same_v <T, uint128_t>
+                || std::is_same_v <T, int128_t>) {
+                ds.write(&value, sizeof(T));
+            } else if constexpr (std::is_same_v <T, unsigned_int>) {
+                write_varuint32(ds, value.value);
+            } else if constexpr (std::is_same_v <T, std::string>) {
+                write_varuint32(ds, value.size());
+                ds.write(value.data(), value.size());
+            } else if constexpr (is_specialization <T, std::vector>::value) {
+                write_varuint32(ds, value.size());
+                if constexpr (is_byte <typename T::value_type>) {
+                    ds.write(value.data(), value.size());
+                } else {
+                    for (const auto &element : value) {
+                        write_value(ds, element);
+                    }
+                }
+            } else if constexpr (is_std_array <T>::value) {
+                for (const auto &element : value) {
+                    write_value(ds, element);
+                }
+            } else if constexpr (is_specialization <T, std::pair>::value) {
+                write_value(ds, value.first);
+                write_value(ds, value.second);
+            } else if constexpr (is_specialization <T, std::tuple>::value) {
+                std::apply([&](const auto &... elements) { (write_value(ds, elements), ...); }, value);
+            } else if constexpr (is_specialization <T, std::optional>::value) {
+                write_value(ds, value.has_value());
+                if (value.has_value()) {
+                    write_value(ds, *value);
+                }
+            } else if constexpr (is_specialization <T, std::variant>::value) {
+                write_varuint32(ds, value.index());
+                std::visit([&](const auto &alternative) { write_value(ds, alternative); }, value);
+            } else if constexpr (is_specialization <T, std::map>::value) {
+                write_varuint32(ds, value.size());
+                for (const auto &entry : value) {
+                    write_value(ds, entry.first);
+                    write_value(ds, entry.second);
+                }
+            } else if constexpr (is_specialization <T, binary_extension>::value) {
+                if (value.has_value()) {
+                    write_value(ds, value.value());
+                }
+            } else if constexpr (reflector <T>::is_reflected) {
+                reflector <T>::for_each_field(value, [&](const auto &field) { write_value(ds, field); });
+            } else {
+                static_assert(dependent_false <T>, "The type needs to be reflected with EOSIO_EMULATOR_REFLECT");
+            }
+        }
+
+
+        template <typename Stream, typename T>
+        void read_value(Stream &ds, T &value) {
+            if constexpr (std::is_same_v <T, bool>) {
+                uint8_t byte;
+                ds.read(&byte, 1);
+                check(byte <= 1, "boolean value must be 0 or 1");
+                value = byte == 1;
+            } else if constexpr (std::is_arithmetic_v <T> || std::is_enum_v <T> || std::is_same_v <T, uint128_t>
+                || std::is_same_v <T, int128_t>) {
+                ds.read(&value, sizeof(T));
+            } else if constexpr (std::is_same_v <T, unsigned_int>) {
+                value.value = read_varuint32(ds);
+            } else if constexpr (std::is_same_v <T, std::string>) {
+                uint32_t size = read_varuint32(ds);
+                check(size <= ds.remaining(), "datastream attempted to read past the end");
+                value.resize(size);
+                ds.read(value.data(), size);
+            } else if constexpr (is_specialization <T, std::vector>::value) {
+                uint32_t size = read_varuint32(ds);
+                value.clear();
+                if constexpr (is_byte <typename T::value_type>) {
+                    check(size <= ds.remaining(), "datastream attempted to read past the end");
+                    value.resize(size);
+                    ds.read(value.data(), size);
+                } else {
+                    for (uint32_t i = 0; i < size; i++) {
+                        typename T::value_type element{};
+                        read_value(ds, element);
+                        value.push_back(std::move(element));
+                    }
+                }
+            } else if constexpr (is_std_array <T>::value) {
+                for (auto &element : value) {
+                    read_value(ds, element);
+                }
+            } else if constexpr (is_specialization <T, std::pair>::value) {
+                read_value(ds, value.first);
+                read_value(ds, value.second);
+            } else if constexpr (is_specialization <T, std::tuple>::value) {
+                std::apply([&](auto &... elements) { (read_value(ds, elements), ...); }, value);
+            } else if constexpr (is_specialization <T, std::optional>::value) {
+                bool has_value;
+                read_value(ds, has_value);
+                value.reset();
+                if (has_value) {
+                    typename T::value_type element{};
+                    read_value(ds, element);
+                    value = std::move(element);
+                }
+            } else if constexpr (is_specialization <T, std::variant>::value) {
+                uint32_t index = read_varuint32(ds);
+                check(index < std::variant_size_v <T>, "invalid variant index");
+                read_variant_alternative(ds, value, index, std::make_index_sequence <std::variant_size_v <T>>{});
+            } else if constexpr (is_specialization <T, std::map>::value) {
+                uint32_t size = read_varuint32(ds);
+                value.clear();
+                for (uint32_t i = 0; i < size; i++) {
+                    typename T::key_type key{};
+                    typename T::mapped_type mapped{};
+                    read_value(ds, key);
+                    read_value(ds, mapped);
+                    value.emplace(std::move(key), std::move(mapped));
+                }
+            } else if constexpr (is_specialization <T, binary_extension>::value) {
+                value.reset();
+                if (ds.remaining() != 0) {
+                    read_value(ds, value.emplace());
+                }
+            } else if constexpr (reflector <T>::is_reflected) {
+                reflector <T>::for_each_field(value, [&](auto &field) { read_value(ds, field); });
+            } else {
+                static_assert(dependent_false <T>, "The type needs to be reflected with EOSIO_EMULATOR_REFLECT");
+            }
+        }
+
+
+        template <typename Stream, typename Variant, size_t... Indexes>
+        void read_variant_alternative(Stream &ds, Variant &value, uint32_t index, std::index_sequence <Indexes...>) {
+            ((Indexes == index ? (void) read_value(ds, value.template emplace <Indexes>()) : (void) 0), ...);
+        }
+    }
+
+
+    template <typename T>
+    size_t pack_size(const T &value) {
+        datastream <size_t> ds;
+        emulator::write_value(ds, value);
+        return ds.tellp();
+    }
+
+    template <typename T>
+    std::vector <char> pack(const T &value) {
+        std::vector <char> result(pack_size(value));
+        datastream <char *> ds(result.data(), result.size());
+        emulator::write_value(ds, value);
+        return result;
+    }
+
+    template <typename T>
+    T unpack(const char *buffer, size_t len) {
+        T result{};
+        datastream <const char *> ds(buffer, len);
+        emulator::read_value(ds, result);
+        check(ds.remaining() == 0, "unpacked data has trailing bytes");
+        return result;
+    }
+
+    template <typename T>
+    T unpack(const std::vector <char> &bytes) {
+        return unpack <T>(bytes.data(), bytes.size());
+    }
+}
+
+
+#define EOSIO_EMULATOR_PARENS ()
+
+#define EOSIO_EMULATOR_EXPAND(...) EOSIO_EMULATOR_EXPAND3(EOSIO_EMULATOR_EXPAND3(EOSIO_EMULATOR_EXPAND3(__VA_ARGS__)))
+#define EOSIO_EMULATOR_EXPAND3(...) EOSIO_EMULATOR_EXPAND2(EOSIO_EMULATOR_EXPAND2(EOSIO_EMULATOR_EXPAND2(__VA_ARGS__)))
+#define EOSIO_EMULATOR_EXPAND2(...) EOSIO_EMULATOR_EXPAND1(EOSIO_EMULATOR_EXPAND1(EOSIO_EMULATOR_EXPAND1(__VA_ARGS__)))
+#define EOSIO_EMULATOR_EXPAND1(...) __VA_ARGS__
+
+#define EOSIO_EMULATOR_FOR_EACH(MACRO, ...) \
+    __VA_OPT__(EOSIO_EMULATOR_EXPAND(EOSIO_EMULATOR_FOR_EACH_HELPER(MACRO, __VA_ARGS__)))
+#define EOSIO_EMULATOR_FOR_EACH_HELPER(MACRO, FIRST, ...) \
+    MACRO(FIRST) __VA_OPT__(EOSIO_EMULATOR_FOR_EACH_AGAIN EOSIO_EMULATOR_PARENS (MACRO, __VA_ARGS__))
+#define EOSIO_EMULATOR_FOR_EACH_AGAIN() EOSIO_EMULATOR_FOR_EACH_HELPER
+
+#define EOSIO_EMULATOR_REFLECT_FIELD(FIELD) f(value.FIELD);
+
+/**
+* Lists the fields of TYPE in declaration order, so that it can be serialized
+* Needs to be used at global scope with a fully qualified TYPE
+*/
+#define EOSIO_EMULATOR_REFLECT(TYPE, ...) \
+    namespace eosio { \
+        template <> \
+        struct reflector <TYPE> { \
+            static constexpr bool is_reflected = true; \
+            template <typename V, typename F> \
+            static void for_each_field(V &value, F &&f) { \
+                EOSIO_EMULATOR_FOR_EACH(EOSIO_EMULATOR_REFLECT_FIELD, __VA_ARGS__) \
+            } \
+        }; \
+    }
+
+
+EOSIO_EMULATOR_REFLECT(::eosio::name, value)
+EOSIO_EMULATOR_REFLECT(::eosio::symbol_code, value)
+EOSIO_EMULATOR_REFLECT(::eosio::symbol, value)
+EOSIO_EMULATOR_REFLECT(::eosio::extended_symbol, sym, contract)
+EOSIO_EMULATOR_REFLECT(::eosio::asset, amount, symbol)
+EOSIO_EMULATOR_REFLECT(::eosio::extended_asset, quantity, contract)
+EOSIO_EMULATOR_REFLECT(::eosio::microseconds, _count)
+EOSIO_EMULATOR_REFLECT(::eosio::time_point, elapsed)
+EOSIO_EMULATOR_REFLECT(::eosio::time_point_sec, utc_seconds)
@@ -0,0 +1,219 @@
+/*
+
+State of the emulated chain that the host emulation of the CDT reads and writes.
+
+The chain state holds the context of the action that is currently applied (receiver, authorizations,
+notification), the emulated block time, the inline actions and console output that the action produced,
+and counters of the database work it did. RAM is billed per payer with the same overheads that the chain
+bills for table rows, secondary index rows and table scopes, and the RAM rules of the chain are enforced:
+inside of an action, only the receiver or an account that authorized the action can be billed, and in
+notifications only the receiver.
+
+Every table write inside of a transaction is recorded in an undo log, so that a failed transaction can be
+rolled back without copying any tables.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "check.hpp"
+#include "name.hpp"
+
+namespace eosio {
+    struct permission_level {
+        name actor;
+        name permission;
+
+        friend bool operator==(const permission_level &a, const permission_level &b) {
+            return a.actor == b.actor && a.permission == b.permission;
+        }
+    };
+
+    namespace emulator {
+        //RAM that the chain bills on top of the serialized data of a row, per secondary index row (24 bytes
+        //plus the key plus the index overhead) and per table scope
+        static constexpr int64_t ROW_OVERHEAD = 108;
+        static constexpr int64_t SECONDARY_INDEX_OVERHEAD = 24 + 96;
+        static constexpr int64_t SCOPE_OVERHEAD = 108;
+
+
+        //Database work done through the multi_index and singleton emulation
+        struct db_stats {
+            uint64_t reads         = 0; //lookups and iterator steps that loaded a row
+            uint64_t misses        = 0; //lookups that did not find a row
+            uint64_t writes        = 0; //emplaced, modified and erased rows
+            uint64_t bytes_read    = 0; //serialized size of the loaded rows
+            uint64_t bytes_written = 0; //serialized size of the emplaced and modified rows
+
+            db_stats &operator+=(const db_stats &other) {
+                reads += other.reads;
+                misses += other.misses;
+                writes += other.writes;
+                bytes_read += other.bytes_read;
+                bytes_written += other.bytes_written;
+                return *this;
+            }
+
+            friend db_stats operator-(db_stats a, const db_stats &b) {
+                a.reads -= b.reads;
+                a.misses -= b.misses;
+                a.writes -= b.writes;
+                a.bytes_read -= b.bytes_read;
+                a.bytes_written -= b.bytes_written;
+                return a;
+            }
+        };
+
+
+        struct sent_action {
+            name                           account;
+            name                           action_name;
+            std::vector <permission_level> authorization;
+            std::vector <char>             data;
+        };
+
+
+        //RAM billed for one part of a table: its rows, its scopes, or the rows of one of its secondary indexes
+        struct ram_key {
+            name        code;
+            name        table;
+            std::string part; //"rows", "scope" or "index:<index name>"
+            name        payer;
+
+            friend bool operator<(const ram_key &a, const ram_key &b) {
+                return std::tie(a.code, a.table, a.part, a.payer) < std::tie(b.code, b.table, b.part, b.payer);
+            }
+        };
+
+        struct ram_usage {
+            int64_t rows  = 0;
+            int64_t bytes = 0;
+        };
+
+
+        struct chain_state {
+            uint32_t now = 1600000000;
+
+            //Context of the action that is currently applied
+            bool             in_action      = false;
+            name             receiver;
+            name             first_receiver;
+            bool             notification   = false;
+            std::set <name>  authorizations = {};
+
+            //Output of the current transaction
+            std::vector <sent_action> sent_actions = {};
+            std::vector <name>        recipients   = {};
+            std::string               console      = "";
+
+            db_stats                      stats     = {};
+            std::map <ram_key, ram_usage> ram       = {};
+            int64_t                       ram_bytes = 0; //sum of the bytes of all ram entries
+
+            //Reads and misses of stats per (code, table), to attribute them to the tables they hit
+            std::map <std::pair <name, name>, uint64_t> lookups = {};
+
+            bool                                 in_transaction = false;
+            std::vector <std::function <void()>> undo_log       = {};
+
+            //Clears the tables of every table type that has been used
+            std::vector <std::function <void()>> table_resets = {};
+        };
+
+        inline chain_state &state() {
+            static chain_state current_state;
+            return current_state;
+        }
+
+
+        /**
+        * Clears all tables and resets the chain state, e.g. between two tests
+        */
+        inline void reset() {
+            chain_state &chain = state();
+            for (auto &table_reset : chain.table_resets) {
+                table_reset();
+            }
+            std::vector <std::function <void()>> table_resets = std::move(chain.table_resets);
+            chain = chain_state{};
+            chain.table_resets = std::move(table_resets);
+        }
+
+
+        /**
+        * Fails like the chain does if payer can't be billed for delta bytes in the current action
+        */
+        inline void check_ram_payer(name payer, int64_t delta) {
+            chain_state &chain = state();
+            if (!chain.in_action || delta <= 0 || payer == chain.receiver) {
+                return;
+            }
+            check(!chain.notification, "Cannot charge RAM to other accounts during notify.");
+            check(chain.authorizations.count(payer) != 0, "missing authority of " + payer.to_string());
+        }
+
+
+        inline void bill_ram(name code, name table, const std::string &part, name payer, int64_t rows, int64_t bytes) {
+            ram_usage &usage = state().ram[{code, table, part, payer}];
+            usage.rows += rows;
+            usage.bytes += bytes;
+            state().ram_bytes += bytes;
+        }
+
+
+        /**
+        * Gets the RAM billed to an account across all tables
+        */
+        inline int64_t ram_of(name payer) {
+            int64_t bytes = 0;
+            for (const auto &[key, usage] : state().ram) {
+                if (key.payer == payer) {
+                    bytes += usage.bytes;
+                }
+            }
+            return bytes;
+        }
+
+
+        inline void record_undo(std::function <void()> undo) {
+            if (state().in_transaction) {
+                state().undo_log.push_back(std::move(undo));
+            }
+        }
+
+
+        inline void begin_transaction() {
+            chain_state &chain = state();
+            check(!chain.in_transaction, "A transaction is already running");
+            chain.in_transaction = true;
+            chain.undo_log.clear();
+            chain.sent_actions.clear();
+            chain.recipients.clear();
+            chain.console.clear();
+        }
+
+        inline void commit_transaction() {
+            state().in_transaction = false;
+            state().undo_log.clear();
+        }
+
+        inline void rollback_transaction() {
+            chain_state &chain = state();
+            chain.in_transaction = false;
+            for (auto undo_itr = chain.undo_log.rbegin(); undo_itr != chain.undo_log.rend(); undo_itr++) {
+                (*undo_itr)();
+            }
+            chain.undo_log.clear();
+            chain.sent_actions.clear();
+            chain.recipients.clear();
+        }
+    }
+}
@@ -0,0 +1,24 @@
+/*
+
+Host emulation of the parts of the eosio CDT that the contracts of this repository use.
+
+The headers under tests/emulator shadow the CDT headers with the same names, so that the contract sources
+compile unchanged for the host. See emulator.hpp for what is emulated.
+
+*/
+
+#pragma once
+
+#include "action.hpp"
+#include "asset.hpp"
+#include "binary_extension.hpp"
+#include "check.hpp"
+#include "contract.hpp"
+#include "datastream.hpp"
+#include "emulator.hpp"
+#include "multi_index.hpp"
+#include "name.hpp"
+#include "print.hpp"
+#include "symbol.hpp"
+#include "system.hpp"
+#include "time.hpp"
@@ -0,0 +1,554 @@
+/*
+
+Host emulation of eosio::multi_index.
+
+Rows are kept deserialized in memory, ordered by primary key, and every secondary index is an ordered set of
+(secondary key, primary key) pairs, which is the order in which the chain iterates secondary indexes.
+Each row is still serialized once per write to bill RAM and count the bytes that the chain would write.
+
+Lookups and iterator steps that load a row count as one read, like the db_*_i64 intrinsics that multi_index
+calls on chain. Writes follow the same rules as on chain: only the receiver can write its own tables, and the
+RAM payer needs to be allowed to pay (see emulator::check_ram_payer).
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <set>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "check.hpp"
+#include "datastream.hpp"
+#include "emulator.hpp"
+#include "name.hpp"
+
+namespace eosio {
+    static constexpr name same_payer{};
+
+
+    template <typename T, typename K, K (T::*PtrToMemberFunction)() const>
+    struct const_mem_fun {
+        typedef K result_type;
+
+        K operator()(const T &object) const { return (object.*PtrToMemberFunction)(); }
+    };
+
+
+    template <name::raw IndexName, typename Extractor>
+    struct indexed_by {
+        static constexpr name index_name = name(IndexName);
+
+        typedef Extractor secondary_extractor_type;
+    };
+
+
+    namespace emulator {
+        /**
+        * The rows of one table in one scope of a contract, with their secondary indexes
+        * The functions of this struct bill RAM, but don't check anything and don't record undo entries,
+        * so that they can be used to undo writes as well
+        */
+        template <typename T, typename... Indices>
+        struct table_data {
+            struct row {
+                T       value;
+                name    payer;
+                int64_t size; //serialized size of value
+            };
+
+            template <typename Index>
+            using index_key = std::decay_t <decltype(
+                std::declval <typename Index::secondary_extractor_type>()(std::declval <const T &>()))>;
+
+            template <typename Index>
+            using index_set = std::set <std::pair <index_key <Index>, uint64_t>>;
+
+            name     code;
+            name     table;
+            uint64_t scope = 0;
+            name     scope_payer;
+
+            std::map <uint64_t, row>              rows    = {};
+            std::tuple <index_set <Indices>...>  indexes = {};
+
+            static constexpr int64_t index_row_bytes() {
+                return (0 + ... + (SECONDARY_INDEX_OVERHEAD + (int64_t) sizeof(index_key <Indices>)));
+            }
+
+            /**
+            * RAM billed for a row with a value of the specified serialized size, including its secondary index rows
+            */
+            static constexpr int64_t billable_size(int64_t size) {
+                return ROW_OVERHEAD + size + index_row_bytes();
+            }
+
+            void bill_row(const row &r, int64_t sign) {
+                bill_ram(code, table, "rows", r.payer, sign, sign * (ROW_OVERHEAD + r.size));
+                (bill_ram(code, table, "index:" + Indices::index_name.to_string(), r.payer, sign,
+                    sign * (SECONDARY_INDEX_OVERHEAD + (int64_t) sizeof(index_key <Indices>))), ...);
+            }
+
+            template <size_t... N>
+            void update_index_keys(const T &value, uint64_t primary_key, bool add, std::index_sequence <N...>) {
+                ((add ? (void) std::get <N>(indexes).insert({
+                        typename Indices::secondary_extractor_type()(value), primary_key})
+                      : (void) std::get <N>(indexes).erase({
+                        typename Indices::secondary_extractor_type()(value), primary_key})), ...);
+            }
+
+            void insert(uint64_t primary_key, const T &value, name payer) {
+                if (rows.empty()) {
+                    scope_payer = payer;
+                    bill_ram(code, table, "scope", payer, 1, SCOPE_OVERHEAD);
+                }
+                row &r = rows.emplace(primary_key, row{value, payer, (int64_t) pack_size(value)}).first->second;
+                update_index_keys(r.value, primary_key, true, std::index_sequence_for <Indices...>{});
+                bill_row(r, 1);
+            }
+
+            void remove(uint64_t primary_key) {
+                auto row_itr = rows.find(primary_key);
+                bill_row(row_itr->second, -1);
+                update_index_keys(row_itr->second.value, primary_key, false, std::index_sequence_for <Indices...>{});
+                rows.erase(row_itr);
+                if (rows.empty()) {
+                    bill_ram(code, table, "scope", scope_payer, -1, -SCOPE_OVERHEAD);
+                }
+            }
+
+            void replace(uint64_t primary_key, const T &value, name payer) {
+                row &r = rows.at(primary_key);
+                bill_row(r, -1);
+                update_index_keys(r.value, primary_key, false, std::index_sequence_for <Indices...>{});
+                r.value = value;
+                r.payer = payer;
+                r.size = (int64_t) pack_size(value);
+                update_index_keys(r.value, primary_key, true, std::index_sequence_for <Indices...>{});
+                bill_row(r, 1);
+            }
+
+            void count_read(const row *r) {
+                state().lookups[{code, table}]++;
+                if (r != nullptr) {
+                    state().stats.reads++;
+                    state().stats.bytes_read += r->size;
+                } else {
+                    state().stats.misses++;
+                }
+            }
+        };
+
+
+        /**
+        * Gets the rows of a table in a scope of a contract
+        * The returned reference stays valid for the lifetime of the program
+        */
+        template <typename T, typename... Indices>
+        table_data <T, Indices...> &get_table_data(name code, uint64_t scope, name table) {
+            typedef std::map <std::tuple <uint64_t, uint64_t, uint64_t>, table_data <T, Indices...>> registry_t;
+            static registry_t registry;
+            //Tables are emptied instead of erased, because multi_index objects keep pointers to them
+            static bool registered = (state().table_resets.push_back([]() {
+                for (auto &[key, data] : registry) {
+                    data.rows.clear();
+                    data.indexes = {};
+                }
+            }), true);
+            (void) registered;
+
+            auto [data_itr, inserted] = registry.try_emplace({code.value, scope, table.value});
+            if (inserted) {
+                data_itr->second.code = code;
+                data_itr->second.table = table;
+                data_itr->second.scope = scope;
+            }
+            return data_itr->second;
+        }
+
+
+        template <name::raw IndexName, size_t N, typename... Indices>
+        struct index_position;
+
+        template <name::raw IndexName, size_t N, typename First, typename... Rest>
+        struct index_position <IndexName, N, First, Rest...> {
+            static constexpr size_t value = First::index_name == name(IndexName)
+                                            ? N : index_position <IndexName, N + 1, Rest...>::value;
+        };
+
+        template <name::raw IndexName, size_t N>
+        struct index_position <IndexName, N> {
+            static constexpr size_t value = N;
+        };
+    }
+
+
+    template <name::raw TableName, typename T, typename... Indices>
+    class multi_index {
+    private:
+        typedef emulator::table_data <T, Indices...> data_t;
+        typedef typename std::map <uint64_t, typename data_t::row>::const_iterator row_iterator;
+
+    public:
+        struct const_iterator {
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const T *;
+            using reference = const T &;
+
+            data_t       *_data = nullptr;
+            row_iterator _itr;
+
+            const T &operator*() const {
+                check(_itr != _data->rows.end(), "cannot dereference end iterator");
+                return _itr->second.value;
+            }
+
+            const T *operator->() const { return &**this; }
+
+            const_iterator &operator++() {
+                check(_itr != _data->rows.end(), "cannot increment end iterator");
+                ++_itr;
+                _data->count_read(_itr == _data->rows.end() ? nullptr : &_itr->second);
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator copy = *this;
+                ++*this;
+                return copy;
+            }
+
+            const_iterator &operator--() {
+                check(_itr != _data->rows.begin(), "cannot decrement iterator at beginning of table");
+                --_itr;
+                _data->count_read(&_itr->second);
+                return *this;
+            }
+
+            const_iterator operator--(int) {
+                const_iterator copy = *this;
+                --*this;
+                return copy;
+            }
+
+            friend bool operator==(const const_iterator &a, const const_iterator &b) { return a._itr == b._itr; }
+
+            friend bool operator!=(const const_iterator &a, const const_iterator &b) { return a._itr != b._itr; }
+        };
+
+        typedef const_iterator iterator;
+        typedef std::reverse_iterator <const_iterator> const_reverse_iterator;
+
+
+        template <name::raw IndexName, typename Extractor, size_t N>
+        class index {
+        private:
+            typedef typename data_t::template index_set <std::tuple_element_t <N, std::tuple <Indices...>>> set_t;
+
+        public:
+            typedef typename Extractor::result_type secondary_key_type;
+
+            struct const_iterator {
+                using iterator_category = std::bidirectional_iterator_tag;
+                using value_type = T;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const T *;
+                using reference = const T &;
+
+                data_t                      *_data = nullptr;
+                typename set_t::const_iterator _itr;
+
+                const set_t &keys() const { return std::get <N>(_data->indexes); }
+
+                const T &operator*() const {
+                    check(_itr != keys().end(), "cannot dereference end iterator");
+                    return _data->rows.at(_itr->second).value;
+                }
+
+                const T *operator->() const { return &**this; }
+
+                const_iterator &operator++() {
+                    check(_itr != keys().end(), "cannot increment end iterator");
+                    ++_itr;
+                    _data->count_read(_itr == keys().end() ? nullptr : &_data->rows.at(_itr->second));
+                    return *this;
+                }
+
+                const_iterator operator++(int) {
+                    const_iterator copy = *this;
+                    ++*this;
+                    return copy;
+                }
+
+                const_iterator &operator--() {
+                    check(_itr != keys().begin(), "cannot decrement iterator at beginning of index");
+                    --_itr;
+                    _data->count_read(&_data->rows.at(_itr->second));
+                    return *this;
+                }
+
+                const_iterator operator--(int) {
+                    const_iterator copy = *this;
+                    --*this;
+                    return copy;
+                }
+
+                friend bool operator==(const const_iterator &a, const const_iterator &b) { return a._itr == b._itr; }
+
+                friend bool operator!=(const const_iterator &a, const const_iterator &b) { return a._itr != b._itr; }
+            };
+
+            typedef std::reverse_iterator <const_iterator> const_reverse_iterator;
+
+            //Unlike on chain, an index stays usable after the multi_index it was created from is destroyed
+            explicit index(const multi_index *multidx) : _multidx(multidx->get_code(), multidx->get_code_scope()) {}
+
+            static constexpr eosio::name name() { return eosio::name(IndexName); }
+
+            eosio::name get_code() const { return _multidx.get_code(); }
+
+            uint64_t get_code_scope() const { return _multidx.get_code_scope(); }
+
+            const_iterator begin() const { return loaded(keys().begin()); }
+
+            const_iterator end() const { return {&_multidx.data(), keys().end()}; }
+
+            const_iterator cbegin() const { return begin(); }
+
+            const_iterator cend() const { return end(); }
+
+            const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+            const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+            const_iterator lower_bound(const secondary_key_type &secondary) const {
+                return loaded(keys().lower_bound({secondary, 0}));
+            }
+
+            const_iterator upper_bound(const secondary_key_type &secondary) const {
+                return loaded(keys().upper_bound({secondary, UINT64_MAX}));
+            }
+
+            const_iterator find(const secondary_key_type &secondary) const {
+                auto key_itr = keys().lower_bound({secondary, 0});
+                if (key_itr == keys().end() || key_itr->first != secondary) {
+                    return loaded(keys().end());
+                }
+                return loaded(key_itr);
+            }
+
+            const_iterator require_find(const secondary_key_type &secondary,
+                const char *error_msg = "unable to find secondary key") const {
+                auto result = find(secondary);
+                check(result != end(), error_msg);
+                return result;
+            }
+
+            const T &get(const secondary_key_type &secondary,
+                const char *error_msg = "unable to find secondary key") const {
+                return *require_find(secondary, error_msg);
+            }
+
+            const_iterator iterator_to(const T &obj) const {
+                return {&_multidx.data(), keys().find({Extractor()(obj), obj.primary_key()})};
+            }
+
+            template <typename Lambda>
+            void modify(const_iterator itr, eosio::name payer, Lambda &&updater) {
+                check(itr != end(), "cannot pass end iterator to modify");
+                _multidx.modify(*itr, payer, std::forward <Lambda>(updater));
+            }
+
+            const_iterator erase(const_iterator itr) {
+                check(itr != end(), "cannot pass end iterator to erase");
+                const_iterator next_itr = itr;
+                ++next_itr._itr;
+                std::pair <secondary_key_type, uint64_t> next_key = next_itr._itr == keys().end()
+                    ? std::pair <secondary_key_type, uint64_t>{} : *next_itr._itr;
+                bool next_is_end = next_itr._itr == keys().end();
+
+                _multidx.erase(*itr);
+                return {&_multidx.data(), next_is_end ? keys().end() : keys().find(next_key)};
+            }
+
+        private:
+            const set_t &keys() const { return std::get <N>(_multidx.data().indexes); }
+
+            const_iterator loaded(typename set_t::const_iterator key_itr) const {
+                data_t &data = _multidx.data();
+                data.count_read(key_itr == keys().end() ? nullptr : &data.rows.at(key_itr->second));
+                return {&data, key_itr};
+            }
+
+            mutable multi_index _multidx;
+        };
+
+
+        multi_index(name code, uint64_t scope) : _code(code), _scope(scope) {}
+
+        name get_code() const { return _code; }
+
+        uint64_t get_code_scope() const { return _scope; }
+
+        const_iterator begin() const { return loaded(data().rows.begin()); }
+
+        const_iterator end() const { return {&data(), data().rows.end()}; }
+
+        const_iterator cbegin() const { return begin(); }
+
+        const_iterator cend() const { return end(); }
+
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        const_iterator lower_bound(uint64_t primary) const { return loaded(data().rows.lower_bound(primary)); }
+
+        const_iterator upper_bound(uint64_t primary) const { return loaded(data().rows.upper_bound(primary)); }
+
+        const_iterator find(uint64_t primary) const { return loaded(data().rows.find(primary)); }
+
+        const_iterator require_find(uint64_t primary, const char *error_msg = "unable to find key") const {
+            auto result = find(primary);
+            check(result != end(), error_msg);
+            return result;
+        }
+
+        const T &get(uint64_t primary, const char *error_msg = "unable to find key") const {
+            return *require_find(primary, error_msg);
+        }
+
+        uint64_t available_primary_key() const {
+            return data().rows.empty() ? 0 : data().rows.rbegin()->first + 1;
+        }
+
+        const_iterator iterator_to(const T &obj) const {
+            auto row_itr = data().rows.find(obj.primary_key());
+            check(row_itr != data().rows.end() && &row_itr->second.value == &obj,
+                "object passed to iterator_to is not in multi_index");
+            return {&data(), row_itr};
+        }
+
+        template <name::raw IndexName>
+        auto get_index() const {
+            constexpr size_t position = emulator::index_position <IndexName, 0, Indices...>::value;
+            static_assert(position < sizeof...(Indices), "name provided is not the name of any secondary index");
+            typedef std::tuple_element_t <position, std::tuple <Indices...>> index_t;
+            return index <IndexName, typename index_t::secondary_extractor_type, position>(this);
+        }
+
+        template <typename Lambda>
+        const_iterator emplace(name payer, Lambda &&constructor) {
+            check_writable("cannot create objects in table of another contract");
+            check(payer.value != 0, "must specify a valid account to pay for new record");
+
+            T obj{};
+            constructor(obj);
+            uint64_t primary = obj.primary_key();
+
+            data_t &rows_data = data();
+            check(rows_data.rows.find(primary) == rows_data.rows.end(),
+                "could not insert object, most likely a uniqueness constraint was violated");
+
+            int64_t size = (int64_t) pack_size(obj);
+            emulator::check_ram_payer(payer, data_t::billable_size(size)
+                + (rows_data.rows.empty() ? emulator::SCOPE_OVERHEAD : 0));
+
+            rows_data.insert(primary, obj, payer);
+            emulator::state().stats.writes++;
+            emulator::state().stats.bytes_written += size;
+            emulator::record_undo([&rows_data, primary]() { rows_data.remove(primary); });
+
+            return {&rows_data, rows_data.rows.find(primary)};
+        }
+
+        template <typename Lambda>
+        void modify(const_iterator itr, name payer, Lambda &&updater) {
+            check(itr != end(), "cannot pass end iterator to modify");
+            modify(*itr, payer, std::forward <Lambda>(updater));
+        }
+
+        template <typename Lambda>
+        void modify(const T &obj, name payer, Lambda &&updater) {
+            check_writable("cannot modify objects in table of another contract");
+
+            data_t &rows_data = data();
+            uint64_t primary = obj.primary_key();
+            auto row_itr = rows_data.rows.find(primary);
+            check(row_itr != rows_data.rows.end() && &row_itr->second.value == &obj,
+                "object passed to modify is not in this multi_index");
+
+            typename data_t::row old_row = row_itr->second;
+            T new_value = old_row.value;
+            updater(new_value);
+            check(new_value.primary_key() == primary, "updater cannot change primary key when modifying an object");
+
+            name new_payer = payer == same_payer ? old_row.payer : payer;
+            int64_t new_size = (int64_t) pack_size(new_value);
+            emulator::check_ram_payer(new_payer, new_payer == old_row.payer
+                ? new_size - old_row.size : data_t::billable_size(new_size));
+
+            rows_data.replace(primary, new_value, new_payer);
+            emulator::state().stats.writes++;
+            emulator::state().stats.bytes_written += new_size;
+            emulator::record_undo([&rows_data, primary, old_row]() {
+                rows_data.replace(primary, old_row.value, old_row.payer);
+            });
+        }
+
+        const_iterator erase(const_iterator itr) {
+            check(itr != end(), "cannot pass end iterator to erase");
+            const_iterator next_itr = itr;
+            ++next_itr._itr;
+            uint64_t next_primary = next_itr._itr == data().rows.end() ? 0 : next_itr._itr->first;
+            bool next_is_end = next_itr._itr == data().rows.end();
+
+            erase(*itr);
+            return {&data(), next_is_end ? data().rows.end() : data().rows.find(next_primary)};
+        }
+
+        void erase(const T &obj) {
+            check_writable("cannot erase objects in table of another contract");
+
+            data_t &rows_data = data();
+            uint64_t primary = obj.primary_key();
+            auto row_itr = rows_data.rows.find(primary);
+            check(row_itr != rows_data.rows.end() && &row_itr->second.value == &obj,
+                "object passed to erase is not in this multi_index");
+
+            typename data_t::row old_row = row_itr->second;
+            rows_data.remove(primary);
+            emulator::state().stats.writes++;
+            emulator::record_undo([&rows_data, primary, old_row]() {
+                rows_data.insert(primary, old_row.value, old_row.payer);
+            });
+        }
+
+        data_t &data() const {
+            if (_data == nullptr) {
+                _data = &emulator::get_table_data <T, Indices...>(_code, _scope, name(TableName));
+            }
+            return *_data;
+        }
+
+    private:
+        void check_writable(const char *error_msg) const {
+            check(!emulator::state().in_action || _code == emulator::state().receiver, error_msg);
+        }
+
+        const_iterator loaded(row_iterator row_itr) const {
+            data().count_read(row_itr == data().rows.end() ? nullptr : &row_itr->second);
+            return {&data(), row_itr};
+        }
+
+        name             _code;
+        uint64_t         _scope;
+        mutable data_t  *_data = nullptr;
+    };
+}
@@ -0,0 +1,39 @@
+/*
+
+Host emulation of eosio::print, which appends to the console output of the current transaction.
+
+*/
+
+#pragma once
+
+#include <string>
+#include <type_traits>
+
+#include "asset.hpp"
+#include "emulator.hpp"
+#include "name.hpp"
+#include "symbol.hpp"
+
+namespace eosio {
+    namespace emulator {
+        inline void print_one(const char *text) { state().console += text; }
+
+        inline void print_one(const std::string &text) { state().console += text; }
+
+        inline void print_one(name n) { state().console += n.to_string(); }
+
+        inline void print_one(symbol_code code) { state().console += code.to_string(); }
+
+        inline void print_one(const asset &quantity) { state().console += quantity.to_string(); }
+
+        inline void print_one(bool value) { state().console += value ? "true" : "false"; }
+
+        template <typename T, typename = std::enable_if_t <std::is_arithmetic_v <T>>>
+        void print_one(T value) { state().console += std::to_string(value); }
+    }
+
+    template <typename... Args>
+    void print(Args &&... args) {
+        (emulator::print_one(std::forward <Args>(args)), ...);
+    }
+}
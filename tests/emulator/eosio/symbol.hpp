@@ -0,0 +1,121 @@
+/*
+
+Host emulation of eosio::symbol_code, eosio::symbol and eosio::extended_symbol.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "name.hpp"
+
+namespace eosio {
+    struct symbol_code {
+        uint64_t value = 0;
+
+        constexpr symbol_code() = default;
+
+        constexpr explicit symbol_code(uint64_t raw) : value(raw) {}
+
+        constexpr explicit symbol_code(std::string_view str) {
+            if (str.size() > 7) {
+                throw emulator::assertion_failure("string is too long to be a valid symbol_code");
+            }
+            for (auto itr = str.rbegin(); itr != str.rend(); ++itr) {
+                if (*itr < 'A' || *itr > 'Z') {
+                    throw emulator::assertion_failure("only uppercase letters allowed in symbol_code string");
+                }
+                value <<= 8;
+                value |= *itr;
+            }
+        }
+
+        constexpr uint64_t raw() const { return value; }
+
+        constexpr explicit operator bool() const { return value != 0; }
+
+        bool is_valid() const {
+            uint64_t sym = value;
+            for (int i = 0; i < 7; i++) {
+                char c = (char) (sym & 0xFF);
+                if (!('A' <= c && c <= 'Z')) {
+                    return false;
+                }
+                sym >>= 8;
+                if (!(sym & 0xFF)) {
+                    do {
+                        sym >>= 8;
+                        if ((sym & 0xFF)) {
+                            return false;
+                        }
+                        i++;
+                    } while (i < 7);
+                }
+            }
+            return true;
+        }
+
+        std::string to_string() const {
+            std::string str;
+            for (uint64_t v = value; v != 0; v >>= 8) {
+                str += (char) (v & 0xFF);
+            }
+            return str;
+        }
+
+        friend constexpr bool operator==(const symbol_code &a, const symbol_code &b) { return a.value == b.value; }
+
+        friend constexpr bool operator!=(const symbol_code &a, const symbol_code &b) { return a.value != b.value; }
+
+        friend constexpr bool operator<(const symbol_code &a, const symbol_code &b) { return a.value < b.value; }
+    };
+
+
+    struct symbol {
+        uint64_t value = 0;
+
+        constexpr symbol() = default;
+
+        constexpr explicit symbol(uint64_t raw) : value(raw) {}
+
+        constexpr symbol(symbol_code sc, uint8_t precision) : value((sc.raw() << 8) | (uint64_t) precision) {}
+
+        constexpr symbol(std::string_view ss, uint8_t precision) : symbol(symbol_code(ss), precision) {}
+
+        constexpr uint64_t raw() const { return value; }
+
+        constexpr uint8_t precision() const { return (uint8_t) (value & 0xFF); }
+
+        constexpr symbol_code code() const { return symbol_code(value >> 8); }
+
+        constexpr explicit operator bool() const { return value != 0; }
+
+        bool is_valid() const { return code().is_valid(); }
+
+        friend constexpr bool operator==(const symbol &a, const symbol &b) { return a.value == b.value; }
+
+        friend constexpr bool operator!=(const symbol &a, const symbol &b) { return a.value != b.value; }
+
+        friend constexpr bool operator<(const symbol &a, const symbol &b) { return a.value < b.value; }
+    };
+
+
+    struct extended_symbol {
+        symbol sym;
+        name   contract;
+
+        symbol get_symbol() const { return sym; }
+
+        name get_contract() const { return contract; }
+
+        friend bool operator==(const extended_symbol &a, const extended_symbol &b) {
+            return a.sym == b.sym && a.contract == b.contract;
+        }
+
+        friend bool operator!=(const extended_symbol &a, const extended_symbol &b) { return !(a == b); }
+    };
+}
@@ -0,0 +1,20 @@
+/*
+
+Host emulation of the eosio system time functions, which return the block time of the emulated chain.
+
+*/
+
+#pragma once
+
+#include "emulator.hpp"
+#include "time.hpp"
+
+namespace eosio {
+    inline time_point current_time_point() {
+        return time_point(seconds(emulator::state().now));
+    }
+
+    inline time_point_sec current_block_time() {
+        return time_point_sec(emulator::state().now);
+    }
+}
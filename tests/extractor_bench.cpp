@@ -0,0 +1,328 @@
+/*
+
+Per-action cost benchmarks of the extractor contract, run on the host harness.
+
+For every combination of table population (stakes of other stakers that already exist) and number of assets
+per stake, a staking cycle is pushed repeatedly and the cost of each action is reported:
+
+  wall_us     median wall time of the action on the host, including the notifications and inline actions
+              it causes, in microseconds. Only comparable between runs on the same machine
+  reads       rows loaded by lookups and iterator steps
+  misses      lookups that did not find a row
+  writes      rows emplaced, modified or erased
+  bytes       serialized bytes of the loaded and written rows
+  ram         RAM billed to all payers by the action, in bytes (negative if RAM was freed)
+
+The RAM that one stake occupies is then measured per table part, as billed by the emulated chain. The
+lookups of the atomicassets templates table are counted for stakes over several templates, which bounds the
+reads that a cache of known-transferable templates could save. Finally, the fixed point settlement math is
+compared with a synthetic double implementation of the same formula.
+
+The database counters are deterministic, so they can be compared between commits to catch regressions
+of the hot paths. Pass --quick for a small run, as done by ctest.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "extractor_host.hpp"
+
+static constexpr name SELF = extractor_host::SELF;
+static constexpr name STAKER = name("staker");
+static constexpr name COLLECTION = name("benchcoll");
+static constexpr symbol APOC = extractor_host::APOC_SYMBOL;
+static constexpr uint32_t PERIOD = 720 * 60;
+
+//Asset ids of the benchmarked staker, far above the ids of the population
+static constexpr uint64_t STAKER_FIRST_ASSET_ID = 1099511627776;
+
+
+struct action_costs {
+    std::vector <uint64_t> nanoseconds = {};
+    extractor_host::action_result last = {};
+};
+
+
+/**
+* Fails the benchmark if an action failed
+*/
+static void record_ok(const std::string &action_name, const extractor_host::action_result &result) {
+    if (!result.succeeded) {
+        std::fprintf(stderr, "%s failed: %s\n", action_name.c_str(), result.error.c_str());
+        std::exit(1);
+    }
+}
+
+
+/**
+* Records the cost of an action result, failing the benchmark if the action failed
+*/
+static void record(std::map <std::string, action_costs> &costs, const std::string &action_name,
+    const extractor_host::action_result &result) {
+    record_ok(action_name, result);
+    costs[action_name].nanoseconds.push_back(result.nanoseconds);
+    costs[action_name].last = result;
+}
+
+
+/**
+* Creates population stakes of one asset each, spread over 676 other stakers
+*/
+static void populate(extractor_host &host, uint64_t population) {
+    for (uint64_t i = 0; i < population; i++) {
+        name owner = name(("pop" + std::string(1, (char) ('a' + (i / 26) % 26)) + std::string(1, (char) ('a' + i % 26)))
+            .c_str());
+        host.mint_asset(owner, 1 + i, COLLECTION, 1);
+        record_ok("populating", host.push(owner, CALL(stake(owner, {1 + i}))));
+    }
+}
+
+
+static void bench(uint64_t population, uint64_t assets_per_stake, int iterations) {
+    extractor_host host;
+    host.create_collection(COLLECTION, name("author"));
+    host.create_template(COLLECTION, 1, true);
+    host.push(SELF, CALL(init()));
+    host.push(SELF, CALL(addsegment(time_point_sec(host.now()), asset(1000000, APOC))));
+    host.push(SELF, CALL(setcollrate(COLLECTION, 100)));
+    populate(host, population);
+
+    std::vector <uint64_t> asset_ids = {};
+    for (uint64_t i = 0; i < assets_per_stake + 1; i++) {
+        host.mint_asset(STAKER, STAKER_FIRST_ASSET_ID + i, COLLECTION, 1);
+        asset_ids.push_back(STAKER_FIRST_ASSET_ID + i);
+    }
+    uint64_t extra_asset_id = asset_ids.back();
+    asset_ids.pop_back();
+
+    std::map <std::string, action_costs> costs;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        record(costs, "stake", host.push(STAKER, CALL(stake(STAKER, asset_ids))));
+        uint64_t stake_id = host.last_stake_id();
+        host.advance(PERIOD);
+
+        record(costs, "claimstake", host.push(STAKER, CALL(claimstake(stake_id))));
+        record(costs, "addtostake", host.push(STAKER, CALL(addtostake(stake_id, {extra_asset_id}))));
+        host.advance(PERIOD);
+        record(costs, "removefromstake", host.push(STAKER, CALL(removefromstake(stake_id, {extra_asset_id}))));
+        host.advance(PERIOD);
+        record(costs, "unstake", host.push(STAKER, CALL(unstake(stake_id))));
+
+        record(costs, "claim", host.push(STAKER, CALL(claim(STAKER, asset(host.balance_of(STAKER), APOC)))));
+        record(costs, "receive_token_transfer",
+            host.transfer_tokens(name("apocalyptics"), STAKER, SELF, asset(10000, APOC), "claim"));
+        record(costs, "claim (deposit)", host.push(STAKER, CALL(claim(STAKER, asset(10000, APOC)))));
+
+        record(costs, "openstake", host.push(STAKER, CALL(openstake(STAKER, asset_ids))));
+        uint64_t custodial_stake_id = host.last_stake_id();
+        record(costs, "receive_asset_transfer",
+            host.transfer_assets(STAKER, SELF, asset_ids, "stake:" + std::to_string(custodial_stake_id)));
+        host.advance(PERIOD);
+        record(costs, "unstake (custodial)", host.push(STAKER, CALL(unstake(custodial_stake_id))));
+    }
+
+    const char *order[] = {"stake", "claimstake", "addtostake", "removefromstake", "unstake", "claim",
+        "receive_token_transfer", "claim (deposit)", "openstake", "receive_asset_transfer", "unstake (custodial)"};
+    for (const char *action_name : order) {
+        action_costs &action = costs[action_name];
+        std::sort(action.nanoseconds.begin(), action.nanoseconds.end());
+        double median_us = action.nanoseconds[action.nanoseconds.size() / 2] / 1000.0;
+        const emulator::db_stats &stats = action.last.stats;
+        std::printf("%-24s %10llu %7llu %9.1f %7llu %7llu %7llu %9llu %8lld\n",
+            action_name,
+            (unsigned long long) population,
+            (unsigned long long) assets_per_stake,
+            median_us,
+            (unsigned long long) stats.reads,
+            (unsigned long long) stats.misses,
+            (unsigned long long) stats.writes,
+            (unsigned long long) (stats.bytes_read + stats.bytes_written),
+            (long long) action.last.ram_delta);
+    }
+}
+
+
+/**
+* Returns the RAM billed for each part of the contract tables, keyed by "<table> <part>"
+*/
+static std::map <std::string, int64_t> contract_ram() {
+    std::map <std::string, int64_t> ram_by_part = {};
+    for (const auto &[key, usage] : emulator::state().ram) {
+        if (key.code == SELF) {
+            ram_by_part[key.table.to_string() + " " + key.part] += usage.bytes;
+        }
+    }
+    return ram_by_part;
+}
+
+
+/**
+* Measures the RAM that one stake occupies, per table part, by staking assets next to an existing stake
+* The existing stake keeps the table scopes from being billed to the measured stake
+*/
+static void bench_ram_per_stake(uint64_t assets_per_stake) {
+    extractor_host host;
+    host.create_collection(COLLECTION, name("author"));
+    host.create_template(COLLECTION, 1, true);
+    host.push(SELF, CALL(init()));
+    host.push(SELF, CALL(setcollrate(COLLECTION, 100)));
+    populate(host, 1);
+
+    std::vector <uint64_t> asset_ids = {};
+    for (uint64_t i = 0; i < assets_per_stake; i++) {
+        //Ids in the 2^40 range, with gaps as they occur between assets minted in the same collection
+        uint64_t asset_id = STAKER_FIRST_ASSET_ID + i * 7;
+        host.mint_asset(STAKER, asset_id, COLLECTION, 1);
+        asset_ids.push_back(asset_id);
+    }
+
+    std::map <std::string, int64_t> ram_before = contract_ram();
+    record_ok("stake", host.push(STAKER, CALL(stake(STAKER, asset_ids))));
+    int64_t total = 0;
+    for (const auto &[part, bytes] : contract_ram()) {
+        int64_t delta = bytes - ram_before[part];
+        if (delta != 0) {
+            std::printf("%-28s %7llu %8lld\n", part.c_str(), (unsigned long long) assets_per_stake, (long long) delta);
+            total += delta;
+        }
+    }
+    std::printf("%-28s %7llu %8lld\n", "total", (unsigned long long) assets_per_stake, (long long) total);
+}
+
+
+/**
+* Counts the lookups of a stake action, and how many of them hit the atomicassets templates table, for a stake
+* whose assets are spread evenly over distinct_templates templates of one collection
+* 
+* Each distinct template is looked up once per stake. A cache of known-transferable templates in a contract
+* table would still need one lookup per template, unless one row covered a range of template ids. Such a
+* range cache could at best replace all template lookups of a stake with a single one, so the template
+* lookups minus one are an upper bound of what it could save
+*/
+static void bench_template_reads(uint64_t assets_per_stake, uint64_t distinct_templates) {
+    extractor_host host;
+    host.create_collection(COLLECTION, name("author"));
+    for (uint64_t template_id = 1; template_id <= distinct_templates; template_id++) {
+        host.create_template(COLLECTION, (int32_t) template_id, true);
+    }
+    host.push(SELF, CALL(init()));
+    host.push(SELF, CALL(setcollrate(COLLECTION, 100)));
+    populate(host, 100);
+
+    std::vector <uint64_t> asset_ids = {};
+    for (uint64_t i = 0; i < assets_per_stake; i++) {
+        host.mint_asset(STAKER, STAKER_FIRST_ASSET_ID + i, COLLECTION, (int32_t) (1 + i % distinct_templates));
+        asset_ids.push_back(STAKER_FIRST_ASSET_ID + i);
+    }
+
+    std::pair <name, name> templates_table = {atomicassets::ATOMICASSETS_ACCOUNT, name("templates")};
+    uint64_t template_lookups_before = emulator::state().lookups[templates_table];
+    extractor_host::action_result staked = host.push(STAKER, CALL(stake(STAKER, asset_ids)));
+    record_ok("stake", staked);
+    uint64_t template_lookups = emulator::state().lookups[templates_table] - template_lookups_before;
+    uint64_t lookups = staked.stats.reads + staked.stats.misses;
+
+    std::printf("%-16s %7llu %9llu %8llu %9llu %10.1f%%\n", "stake",
+        (unsigned long long) assets_per_stake,
+        (unsigned long long) distinct_templates,
+        (unsigned long long) lookups,
+        (unsigned long long) template_lookups,
+        100.0 * (double) (template_lookups - 1) / (double) lookups);
+}
+
+
+/**
+* Compares the checked fixed point settlement of a stake's rewards with a synthetic double implementation
+* of the same formula, written for this comparison only, that also converts the amount to a display value
+* by dividing it by pow(10, precision). On the host, doubles run on the FPU; in WASM they are emulated in
+* software, so the fixed point path compares even more favourably on chain. Results that differ show the
+* drift of doubles
+*/
+static void bench_settlement_math(uint64_t samples) {
+    std::vector <std::pair <uint128_t, uint64_t>> inputs = {};
+    uint64_t random_state = 88172645463325252ull;
+    auto next_random = [&]() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        return random_state;
+    };
+    for (uint64_t i = 0; i < samples; i++) {
+        //Reward per unit deltas up to 2^62, stakes of up to 2^32 units
+        uint128_t reward_per_unit_delta = next_random() >> 2;
+        uint64_t units = next_random() >> 32;
+        inputs.push_back({reward_per_unit_delta, units});
+    }
+
+    volatile int64_t fixed_sink = 0;
+    auto fixed_start = std::chrono::steady_clock::now();
+    for (const auto &[reward_per_unit_delta, units] : inputs) {
+        fixed_sink = fixedpoint::to_amount(fixedpoint::mul_div(reward_per_unit_delta, units, REWARD_PRECISION));
+    }
+    auto fixed_end = std::chrono::steady_clock::now();
+
+    volatile double double_sink = 0;
+    auto double_start = std::chrono::steady_clock::now();
+    for (const auto &[reward_per_unit_delta, units] : inputs) {
+        double_sink = (double) reward_per_unit_delta * (double) units / (double) REWARD_PRECISION / pow(10, 4);
+    }
+    auto double_end = std::chrono::steady_clock::now();
+
+    uint64_t differing_results = 0;
+    for (const auto &[reward_per_unit_delta, units] : inputs) {
+        int64_t fixed_amount = fixedpoint::to_amount(fixedpoint::mul_div(reward_per_unit_delta, units, REWARD_PRECISION));
+        double double_amount = (double) reward_per_unit_delta * (double) units / (double) REWARD_PRECISION;
+        if ((int64_t) double_amount != fixed_amount) {
+            differing_results++;
+        }
+    }
+
+    auto per_sample = [&](auto start, auto end) {
+        return (double) std::chrono::duration_cast <std::chrono::nanoseconds>(end - start).count() / samples;
+    };
+    std::printf("\n%-28s %10s %12s\n", "settlement math", "ns/settle", "differing");
+    std::printf("%-28s %10.2f %12llu\n", "fixed point", per_sample(fixed_start, fixed_end), 0ull);
+    std::printf("%-28s %10.2f %12llu\n", "double", per_sample(double_start, double_end),
+        (unsigned long long) differing_results);
+}
+
+
+int main(int argc, char **argv) {
+    bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+
+    std::vector <uint64_t> populations = quick ? std::vector <uint64_t>{0, 100}
+                                               : std::vector <uint64_t>{0, 1000, 10000};
+    std::vector <uint64_t> assets_per_stake = quick ? std::vector <uint64_t>{1, 10}
+                                                    : std::vector <uint64_t>{1, 10, MAX_ASSETS_PER_STAKE - 1};
+    int iterations = quick ? 3 : 25;
+
+    std::printf("%-24s %10s %7s %9s %7s %7s %7s %9s %8s\n",
+        "action", "population", "assets", "wall_us", "reads", "misses", "writes", "bytes", "ram");
+    for (uint64_t population : populations) {
+        for (uint64_t assets : assets_per_stake) {
+            bench(population, assets, iterations);
+        }
+    }
+
+    std::printf("\n%-28s %7s %8s\n", "ram per stake", "assets", "bytes");
+    for (uint64_t assets : {(uint64_t) 1, (uint64_t) 10, MAX_ASSETS_PER_STAKE}) {
+        bench_ram_per_stake(assets);
+    }
+
+    std::printf("\n%-16s %7s %9s %8s %9s %11s\n", "template reads", "assets", "templates", "lookups", "template",
+        "max saved");
+    for (auto [assets, templates] : std::vector <std::pair <uint64_t, uint64_t>>{{10, 1}, {10, 3}, {10, 10},
+             {MAX_ASSETS_PER_STAKE, 10}}) {
+        bench_template_reads(assets, templates);
+    }
+
+    bench_settlement_math(quick ? 10000 : 10000000);
+    return 0;
+}
@@ -0,0 +1,522 @@
+/*
+
+Host harness of the extractor contract.
+
+The contract source is compiled for the host against the CDT emulation in tests/emulator. The harness applies
+actions like the chain does: every action runs against a fresh contract object inside of a transaction, the
+notifications and inline actions that it produces are applied after it in order, and a failing check anywhere
+rolls the whole transaction back. Transfers sent to atomicassets move the asset rows between the owner scopes
+and notify the contract, so custodial stakes go through the same notification path as on chain.
+
+The result of every pushed transaction contains its wall time and the database work it did, which the tests
+and the benchmarks use.
+
+*/
+
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <extractor.cpp>
+
+//Wraps a call of a contract action or helper for extractor_host::push and extractor_host::read,
+//e.g. host.push(owner, CALL(stake(owner, {1, 2})))
+#define CALL(...) [&](extractor &contract) { return contract.__VA_ARGS__; }
+
+EOSIO_EMULATOR_REFLECT(::atomicassets::FORMAT, name, type)
+EOSIO_EMULATOR_REFLECT(::atomicassets::collections_s, collection_name, author, allow_notify, authorized_accounts,
+    notify_accounts, market_fee, serialized_data)
+EOSIO_EMULATOR_REFLECT(::atomicassets::schemas_s, schema_name, format)
+EOSIO_EMULATOR_REFLECT(::atomicassets::templates_s, template_id, schema_name, transferable, burnable, max_supply,
+    issued_supply, immutable_serialized_data)
+EOSIO_EMULATOR_REFLECT(::atomicassets::assets_s, asset_id, collection_name, schema_name, template_id, ram_payer,
+    backed_tokens, immutable_serialized_data, mutable_serialized_data)
+EOSIO_EMULATOR_REFLECT(::atomicassets::offers_s, offer_id, sender, recipient, sender_asset_ids, recipient_asset_ids,
+    memo, ram_payer)
+EOSIO_EMULATOR_REFLECT(::atomicassets::balances_s, owner, quantities)
+EOSIO_EMULATOR_REFLECT(::atomicassets::config_s, asset_counter, template_counter, offer_counter, collection_format,
+    supported_tokens)
+EOSIO_EMULATOR_REFLECT(::atomicassets::tokenconfigs_s, standard, version)
+
+EOSIO_EMULATOR_REFLECT(::delphioracle::pairs_s, active, bounty_awarded, bounty_edited_by_custodians, proposer, name,
+    bounty_amount, approving_custodians, approving_oracles, base_symbol, base_type, base_contract, quote_symbol,
+    quote_type, quote_contract, quoted_precision)
+EOSIO_EMULATOR_REFLECT(::delphioracle::datapoints_s, id, owner, value, median, timestamp)
+
+EOSIO_EMULATOR_REFLECT(::extractor::COUNTER_RANGE, counter_name, start_id, end_id)
+EOSIO_EMULATOR_REFLECT(::extractor::RARITY_WEIGHT, value, weight)
+EOSIO_EMULATOR_REFLECT(::extractor::STAKE_VIEW, stake_id, owner, collection_name, asset_ids, units, custodial)
+EOSIO_EMULATOR_REFLECT(::extractor::OWNER_CREDIT, owner, quantity)
+EOSIO_EMULATOR_REFLECT(::extractor::STAKES_PAGE, stakes, more, next_stake_id)
+EOSIO_EMULATOR_REFLECT(::extractor::TOKEN, token_contract, token_symbol)
+EOSIO_EMULATOR_REFLECT(::extractor::PRICE_SAMPLE, timestamp, price, cumulative_price)
+EOSIO_EMULATOR_REFLECT(::extractor::counters_s, counter_name, counter_value)
+EOSIO_EMULATOR_REFLECT(::extractor::cursors_s, cursor_name, position)
+EOSIO_EMULATOR_REFLECT(::extractor::balances_s, owner, quantities)
+EOSIO_EMULATOR_REFLECT(::extractor::accounts_s, balance)
+EOSIO_EMULATOR_REFLECT(::extractor::stake_s, stake_id, owner, collection_name, packed_asset_ids,
+    units, reward_checkpoint, custodial, pending)
+EOSIO_EMULATOR_REFLECT(::extractor::stakedassets_s, asset_id, stake_id, units)
+EOSIO_EMULATOR_REFLECT(::extractor::config_s, version, stake_counter, minimum_claim_duration,
+    minimum_calc_duaration, apoc_token, atomicassets_account, log_mode)
+EOSIO_EMULATOR_REFLECT(::extractor::migration_s, step, cursor, migrated_rows)
+EOSIO_EMULATOR_REFLECT(::extractor::emission_s, start_time, emission_per_period, cumulative_emission)
+EOSIO_EMULATOR_REFLECT(::extractor::collrates_s, collection_name, weight)
+EOSIO_EMULATOR_REFLECT(::extractor::collstats_s, collection_name, staked_items, stake_count, units, rewards_settled)
+EOSIO_EMULATOR_REFLECT(::extractor::statstally_s, collection_name, staked_items, stake_count, units)
+EOSIO_EMULATOR_REFLECT(::extractor::statscheck_s, phase, cursor, mismatched_rows)
+EOSIO_EMULATOR_REFLECT(::extractor::rarityconf_s, collection_name, attribute_name, weights, default_weight, config_id)
+EOSIO_EMULATOR_REFLECT(::extractor::tmplweights_s, template_id, weight, config_id)
+EOSIO_EMULATOR_REFLECT(::extractor::tokens_s, token_symbol, token_contract, enabled)
+EOSIO_EMULATOR_REFLECT(::extractor::pricebuffer_s, delphi_pair_name, min_poke_interval, max_datapoint_age,
+    next_index, samples)
+EOSIO_EMULATOR_REFLECT(::extractor::rewards_s, reward_per_unit, total_units, last_accrual, last_cumulative_emission)
+
+
+class extractor_host {
+public:
+    static constexpr name SELF = name("extractor");
+    static constexpr name ATOMICASSETS = atomicassets::ATOMICASSETS_ACCOUNT;
+    static constexpr name DELPHIORACLE = delphioracle::DELPHIORACLE_ACCOUNT;
+
+    static constexpr symbol APOC_SYMBOL = symbol(symbol_code("APOC"), 4);
+
+    using COUNTER_RANGE = extractor::COUNTER_RANGE;
+    using RARITY_WEIGHT = extractor::RARITY_WEIGHT;
+    using STAKE_VIEW = extractor::STAKE_VIEW;
+    using OWNER_CREDIT = extractor::OWNER_CREDIT;
+    using STAKES_PAGE = extractor::STAKES_PAGE;
+
+    using stake_s = extractor::stake_s;
+    using config_s = extractor::config_s;
+    using rewards_s = extractor::rewards_s;
+
+    using stake_t = extractor::stake_t;
+    using stakedassets_t = extractor::stakedassets_t;
+    using balances_t = extractor::balances_t;
+    using accounts_t = extractor::accounts_t;
+    using cursors_t = extractor::cursors_t;
+    using collrates_t = extractor::collrates_t;
+    using collstats_t = extractor::collstats_t;
+    using statstally_t = extractor::statstally_t;
+    using statscheck_t = extractor::statscheck_t;
+    using tmplweights_t = extractor::tmplweights_t;
+    using rewards_t = extractor::rewards_t;
+    using config_t = extractor::config_t;
+
+    struct action_result {
+        bool                                     succeeded = false;
+        std::string                              error     = "";
+        emulator::db_stats                       stats     = {};
+        uint64_t                                 nanoseconds = 0;
+        int64_t                                  ram_delta = 0; //RAM billed to all payers, in bytes
+        std::vector <emulator::sent_action>      actions   = {}; //every action applied after the pushed one
+        std::string                              console   = "";
+
+        //Whether the transaction failed with an error message that contains the specified text
+        bool failed_with(const std::string &text) const {
+            return !succeeded && error.find(text) != std::string::npos;
+        }
+    };
+
+
+    extractor_host() {
+        emulator::reset();
+    }
+
+    ~extractor_host() {
+        emulator::reset();
+    }
+
+
+    uint32_t now() const { return emulator::state().now; }
+
+    void advance(uint32_t seconds) { emulator::state().now += seconds; }
+
+
+    /**
+    * Pushes a transaction with a single action of the contract, authorized by the specified accounts
+    * apply calls the action on the contract object that is passed to it
+    */
+    template <typename F>
+    action_result push(const std::vector <name> &authorizations, F &&apply) {
+        return run_transaction([&]() {
+            apply_action(SELF, name("action"), authorizations, [&](extractor *contract, name receiver) {
+                if (receiver == SELF) {
+                    apply(*contract);
+                }
+            });
+        });
+    }
+
+    template <typename F>
+    action_result push(name authorization, F &&apply) {
+        return push(std::vector <name>{authorization}, std::forward <F>(apply));
+    }
+
+
+    /**
+    * Calls a read-only action or a helper of the contract and returns its result
+    * Fails the test run if the call writes to any table
+    */
+    template <typename F>
+    auto read(F &&call) {
+        emulator::begin_transaction();
+        emulator::chain_state &chain = emulator::state();
+        uint64_t writes_before = chain.stats.writes;
+        chain.in_action = true;
+        chain.receiver = SELF;
+        chain.first_receiver = SELF;
+        chain.notification = false;
+        chain.authorizations.clear();
+        try {
+            extractor contract(SELF, SELF, datastream <const char *>(nullptr, 0));
+            auto result = call(contract);
+            chain.in_action = false;
+            check(chain.stats.writes == writes_before, "read-only call wrote to the database");
+            emulator::rollback_transaction();
+            return result;
+        } catch (...) {
+            chain.in_action = false;
+            emulator::rollback_transaction();
+            throw;
+        }
+    }
+
+
+    /**
+    * Pushes an atomicassets transfer, which notifies the sender, the recipient and the contract
+    */
+    action_result transfer_assets(name from, name to, const std::vector <uint64_t> &asset_ids, const std::string &memo) {
+        return run_transaction([&]() {
+            queue.push_back({ATOMICASSETS, name("transfer"), {{from, name("active")}},
+                pack(std::make_tuple(from, to, asset_ids, memo))});
+        });
+    }
+
+    /**
+    * Pushes a transfer of a token, which notifies the sender and the recipient like a token contract would
+    * Any account other than atomicassets is treated as a token contract, its balances are not emulated
+    */
+    action_result transfer_tokens(name token_contract, name from, name to, asset quantity, const std::string &memo) {
+        return run_transaction([&]() {
+            queue.push_back({token_contract, name("transfer"), {{from, name("active")}},
+                pack(std::make_tuple(from, to, quantity, memo))});
+        });
+    }
+
+
+    //Fixtures of the atomicassets and delphioracle tables, written directly without an action
+
+    void create_collection(name collection_name, name author) {
+        atomicassets::collections.emplace(ATOMICASSETS, [&](auto &_collection) {
+            _collection.collection_name = collection_name;
+            _collection.author = author;
+            _collection.allow_notify = true;
+        });
+    }
+
+    void create_schema(name collection_name, name schema_name, const std::vector <atomicassets::FORMAT> &format) {
+        atomicassets::get_schemas(collection_name).emplace(ATOMICASSETS, [&](auto &_schema) {
+            _schema.schema_name = schema_name;
+            _schema.format = format;
+        });
+    }
+
+    void create_template(
+        name collection_name,
+        int32_t template_id,
+        bool transferable = true,
+        name schema_name = name(),
+        const std::vector <uint8_t> &immutable_data = {}
+    ) {
+        atomicassets::get_templates(collection_name).emplace(ATOMICASSETS, [&](auto &_template) {
+            _template.template_id = template_id;
+            _template.schema_name = schema_name;
+            _template.transferable = transferable;
+            _template.burnable = true;
+            _template.immutable_serialized_data = immutable_data;
+        });
+    }
+
+    void mint_asset(name owner, uint64_t asset_id, name collection_name, int32_t template_id) {
+        atomicassets::get_assets(owner).emplace(ATOMICASSETS, [&](auto &_asset) {
+            _asset.asset_id = asset_id;
+            _asset.collection_name = collection_name;
+            _asset.template_id = template_id;
+            _asset.ram_payer = ATOMICASSETS;
+        });
+    }
+
+    void burn_asset(name owner, uint64_t asset_id) {
+        auto owner_assets = atomicassets::get_assets(owner);
+        owner_assets.erase(owner_assets.require_find(asset_id, "no such asset"));
+    }
+
+    bool owns_asset(name owner, uint64_t asset_id) {
+        auto owner_assets = atomicassets::get_assets(owner);
+        return owner_assets.find(asset_id) != owner_assets.end();
+    }
+
+    void create_pair(name pair_name) {
+        delphioracle::pairs.emplace(DELPHIORACLE, [&](auto &_pair) {
+            _pair.active = true;
+            _pair.name = pair_name;
+        });
+    }
+
+    void add_datapoint(name pair_name, uint64_t id, uint64_t median, uint32_t timestamp) {
+        delphioracle::get_datapoints(pair_name).emplace(DELPHIORACLE, [&](auto &_datapoint) {
+            _datapoint.id = id;
+            _datapoint.median = median;
+            _datapoint.value = median;
+            _datapoint.timestamp = time_point(seconds(timestamp));
+        });
+    }
+
+
+    //Views of the contract tables
+
+    stake_t stakes() const { return stake_t(SELF, SELF.value); }
+
+    stakedassets_t stakedassets() const { return stakedassets_t(SELF, SELF.value); }
+
+    collstats_t collstats() const { return collstats_t(SELF, SELF.value); }
+
+    rewards_s rewards() const { return rewards_t(SELF, SELF.value).get(); }
+
+    int64_t balance_of(name owner, symbol_code token_code = APOC_SYMBOL.code()) const {
+        accounts_t owner_accounts(SELF, owner.value);
+        auto account_itr = owner_accounts.find(token_code.raw());
+        return account_itr == owner_accounts.end() ? 0 : account_itr->balance.amount;
+    }
+
+    uint64_t last_stake_id() {
+        return read(CALL(getcounters().at(0).end_id));
+    }
+
+
+    //Internals of the contract, evaluated like in an action at the current time
+
+    uint128_t cumulative_emission(uint32_t time) {
+        return read(CALL(get_cumulative_emission(time)));
+    }
+
+    uint64_t collection_weight(name collection_name) {
+        return read(CALL(get_collection_weight(collection_name)));
+    }
+
+    uint64_t cursor(name cursor_name) {
+        return read(CALL(get_cursor(cursor_name)));
+    }
+
+    //Rewards that a stake would settle now
+    int64_t pending_rewards(uint64_t stake_id) {
+        return read([&](extractor &contract) {
+            return contract.get_pending_rewards(contract.get_accrued_rewards(), contract.pool.get(stake_id));
+        });
+    }
+
+
+    /**
+    * Counts the applied actions of a transaction with the specified account and name
+    */
+    static size_t count_actions(const action_result &result, name account, name action_name) {
+        size_t count = 0;
+        for (const auto &applied : result.actions) {
+            if (applied.account == account && applied.action_name == action_name) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+private:
+    struct queued_action {
+        name                           account;
+        name                           action_name;
+        std::vector <permission_level> authorization;
+        std::vector <char>             data;
+    };
+
+    std::deque <queued_action> queue;
+
+
+    static int64_t total_ram() {
+        return emulator::state().ram_bytes;
+    }
+
+
+    template <typename F>
+    action_result run_transaction(F &&start) {
+        action_result result;
+        emulator::chain_state &chain = emulator::state();
+        emulator::db_stats stats_before = chain.stats;
+        int64_t ram_before = total_ram();
+        auto start_time = std::chrono::steady_clock::now();
+
+        emulator::begin_transaction();
+        queue.clear();
+        try {
+            start();
+            while (!queue.empty()) {
+                queued_action next = std::move(queue.front());
+                queue.pop_front();
+                result.actions.push_back({next.account, next.action_name, next.authorization, next.data});
+                apply_queued(next);
+            }
+            emulator::commit_transaction();
+            result.succeeded = true;
+        } catch (const emulator::assertion_failure &e) {
+            chain.in_action = false;
+            emulator::rollback_transaction();
+            result.error = e.what();
+            result.actions.clear();
+        }
+
+        result.nanoseconds = std::chrono::duration_cast <std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+        result.stats = chain.stats - stats_before;
+        result.ram_delta = total_ram() - ram_before;
+        result.console = chain.console;
+        return result;
+    }
+
+
+    /**
+    * Applies an action to its account and to every account that the receivers notify, in the order in which they
+    * were notified. The inline actions that the receivers send are queued
+    * handle is called for every receiver, with the contract object if the receiver is the contract
+    */
+    template <typename F>
+    void apply_action(name code, name action_name, const std::vector <name> &authorizations, F &&handle) {
+        emulator::chain_state &chain = emulator::state();
+        std::vector <name> receivers = {code};
+        for (size_t i = 0; i < receivers.size(); i++) {
+            name receiver = receivers[i];
+            chain.in_action = true;
+            chain.receiver = receiver;
+            chain.first_receiver = code;
+            chain.notification = i != 0;
+            chain.authorizations = std::set <name>(authorizations.begin(), authorizations.end());
+            chain.sent_actions.clear();
+            chain.recipients.clear();
+
+            if (receiver == SELF) {
+                extractor contract(SELF, code, datastream <const char *>(nullptr, 0));
+                handle(&contract, receiver);
+            } else {
+                handle(nullptr, receiver);
+            }
+            chain.in_action = false;
+
+            for (name recipient : chain.recipients) {
+                if (std::find(receivers.begin(), receivers.end(), recipient) == receivers.end()) {
+                    receivers.push_back(recipient);
+                }
+            }
+            for (auto &sent : chain.sent_actions) {
+                queue.push_back({sent.account, sent.action_name, sent.authorization, std::move(sent.data)});
+            }
+            chain.sent_actions.clear();
+            chain.recipients.clear();
+        }
+    }
+
+
+    static std::vector <name> actors(const std::vector <permission_level> &authorization) {
+        std::vector <name> result;
+        for (const auto &level : authorization) {
+            result.push_back(level.actor);
+        }
+        return result;
+    }
+
+
+    void apply_queued(const queued_action &next) {
+        apply_action(next.account, next.action_name, actors(next.authorization),
+            [&](extractor *contract, name receiver) {
+                handle(contract, receiver, next.account, next.action_name, next.data);
+            });
+    }
+
+
+    template <typename... Args>
+    static void dispatch(extractor &contract, void (extractor::*action)(Args...), const std::vector <char> &data) {
+        auto arguments = unpack <std::tuple <std::decay_t <Args>...>>(data);
+        std::apply([&](auto &... argument) { (contract.*action)(argument...); }, arguments);
+    }
+
+
+    /**
+    * Handles an action or notification on the chain of the harness
+    * Only the contract itself, atomicassets transfers and token transfers are emulated, other actions are ignored
+    */
+    void handle(extractor *contract, name receiver, name code, name action_name, const std::vector <char> &data) {
+        if (receiver == ATOMICASSETS && action_name == name("transfer")) {
+            auto [from, to, asset_ids, memo] = unpack <std::tuple <name, name, std::vector <uint64_t>, std::string>>(data);
+            apply_atomicassets_transfer(from, to, asset_ids, memo);
+            return;
+        }
+        if (receiver == code && receiver != SELF && action_name == name("transfer")) {
+            auto [from, to, quantity, memo] = unpack <std::tuple <name, name, asset, std::string>>(data);
+            require_auth(from);
+            check(from != to, "cannot transfer to self");
+            check(quantity.is_valid() && quantity.amount > 0, "must transfer positive quantity");
+            require_recipient(from);
+            require_recipient(to);
+            return;
+        }
+        if (receiver != SELF) {
+            return;
+        }
+
+        if (code == ATOMICASSETS && action_name == name("transfer")) {
+            dispatch(*contract, &extractor::receive_asset_transfer, data);
+        } else if (code != SELF && action_name == name("transfer")) {
+            dispatch(*contract, &extractor::receive_token_transfer, data);
+        } else if (code == SELF) {
+            if (action_name == name("lognewstake")) {
+                dispatch(*contract, &extractor::lognewstake, data);
+            } else if (action_name == name("lognewstakes")) {
+                dispatch(*contract, &extractor::lognewstakes, data);
+            } else if (action_name == name("logsweep")) {
+                dispatch(*contract, &extractor::logsweep, data);
+            } else if (action_name == name("logchkstats")) {
+                dispatch(*contract, &extractor::logchkstats, data);
+            } else if (action_name == name("logdistrib")) {
+                dispatch(*contract, &extractor::logdistrib, data);
+            } else if (action_name == name("lognewclaim")) {
+                dispatch(*contract, &extractor::lognewclaim, data);
+            } else {
+                check(false, "the harness does not dispatch the inline action " + action_name.to_string());
+            }
+        }
+    }
+
+
+    void apply_atomicassets_transfer(name from, name to, const std::vector <uint64_t> &asset_ids, const std::string &memo) {
+        require_auth(from);
+        check(from != to, "Can't transfer assets to yourself");
+        check(asset_ids.size() != 0, "asset_ids needs to contain at least one id");
+        check(memo.length() <= 256, "A transfer memo can only be 256 characters max");
+
+        auto from_assets = atomicassets::get_assets(from);
+        auto to_assets = atomicassets::get_assets(to);
+        for (uint64_t asset_id : asset_ids) {
+            auto asset_itr = from_assets.require_find(asset_id,
+                ("Sender doesn't own at least one of the provided assets (ID: " + std::to_string(asset_id) + ")").c_str());
+            atomicassets::assets_s moved_asset = *asset_itr;
+            from_assets.erase(asset_itr);
+            to_assets.emplace(ATOMICASSETS, [&](auto &_asset) { _asset = moved_asset; });
+        }
+
+        require_recipient(from);
+        require_recipient(to);
+    }
+};
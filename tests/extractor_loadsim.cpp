@@ -0,0 +1,388 @@
+/*
+
+Load simulator of the extractor contract, run on the host harness.
+
+A synthetic population of stakers first opens one stake each, then a mixed workload of staking actions is
+pushed in random order. The workload is configured on the command line:
+
+  --stakers=N        number of stakers, each of them opens one stake before the mixed workload (10000)
+  --ops=N            number of actions of the mixed workload (as many as stakers)
+  --collections=N    number of whitelisted collections that the stakes are spread over (20)
+  --skew=S           collection mix, collection i is chosen with a weight of 1 / (i + 1)^S. 0 spreads the
+                     stakes evenly, 1 follows Zipf's law (1)
+  --mean-assets=M    mean number of assets per stake, geometrically distributed (3)
+  --max-assets=N     upper bound of the assets per stake (10)
+  --mix=S:C:U:K:W    ratio of stake, custodial stake (openstake and its asset transfer), unstake, claimstake
+                     and claim actions in the mixed workload (4:1:2:3:1)
+  --seed=N           seed of the workload (1)
+  --quick            small run with 500 stakers, as done by ctest
+
+Every simulated second, one action is pushed. The report lists the wall time percentiles of each action on
+the host, including the notifications and inline actions it causes, and the mean database reads and writes.
+Wall times are only comparable between runs on the same machine, the database counters are deterministic
+for a seed. Then the RAM of the contract tables is listed per table part and payer, as billed by the
+emulated chain at the end of the run. Rows paid by the stakers are summed over all stakers.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "extractor_host.hpp"
+
+static constexpr name SELF = extractor_host::SELF;
+static constexpr symbol APOC = extractor_host::APOC_SYMBOL;
+
+//Asset ids start in the 2^40 range and are assigned in minting order, like the ids of a busy collection
+static constexpr uint64_t FIRST_ASSET_ID = 1099511627776;
+
+
+struct workload_config {
+    uint64_t stakers = 10000;
+    uint64_t ops = 0; //as many as stakers if not set
+    uint64_t collections = 20;
+    double skew = 1;
+    double mean_assets = 3;
+    uint64_t max_assets = 10;
+    std::vector <uint64_t> mix = {4, 1, 2, 3, 1};
+    uint64_t seed = 1;
+};
+
+struct simulated_stake {
+    uint64_t stake_id;
+    name owner;
+};
+
+struct action_costs {
+    std::vector <uint64_t> nanoseconds = {};
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+};
+
+
+/**
+* xorshift64, so that a seed gives the same workload on every platform
+*/
+class workload_random {
+public:
+    explicit workload_random(uint64_t seed) : state(seed == 0 ? 88172645463325252ull : seed) {}
+
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    uint64_t below(uint64_t bound) { return next() % bound; }
+
+    double unit() { return (double) (next() >> 11) / (double) (1ull << 53); }
+
+private:
+    uint64_t state;
+};
+
+
+[[noreturn]] static void usage(const char *argument) {
+    std::fprintf(stderr, "unknown or invalid argument %s, see the top of tests/extractor_loadsim.cpp\n", argument);
+    std::exit(1);
+}
+
+
+static workload_config parse_arguments(int argc, char **argv) {
+    workload_config config;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--quick") {
+            config.stakers = 500;
+            continue;
+        }
+        size_t separator = argument.find('=');
+        if (argument.rfind("--", 0) != 0 || separator == std::string::npos) {
+            usage(argv[i]);
+        }
+        std::string key = argument.substr(2, separator - 2);
+        std::string value = argument.substr(separator + 1);
+        char *end = nullptr;
+        if (key == "mix") {
+            config.mix.clear();
+            for (const char *part = value.c_str(); *part != '\0'; part = *end == ':' ? end + 1 : end) {
+                config.mix.push_back(std::strtoull(part, &end, 10));
+                if (end == part) {
+                    usage(argv[i]);
+                }
+            }
+            if (config.mix.size() != 5) {
+                usage(argv[i]);
+            }
+            continue;
+        }
+        double number = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || number < 0) {
+            usage(argv[i]);
+        }
+        if (key == "stakers") {
+            config.stakers = (uint64_t) number;
+        } else if (key == "ops") {
+            config.ops = (uint64_t) number;
+        } else if (key == "collections") {
+            config.collections = (uint64_t) number;
+        } else if (key == "skew") {
+            config.skew = number;
+        } else if (key == "mean-assets") {
+            config.mean_assets = number;
+        } else if (key == "max-assets") {
+            config.max_assets = (uint64_t) number;
+        } else if (key == "seed") {
+            config.seed = (uint64_t) number;
+        } else {
+            usage(argv[i]);
+        }
+    }
+    if (config.ops == 0) {
+        config.ops = config.stakers;
+    }
+    if (config.stakers == 0 || config.stakers > 26 * 26 * 26 * 26 * 26
+        || config.collections == 0 || config.collections > 26 * 26
+        || config.max_assets == 0 || config.max_assets > MAX_ASSETS_PER_STAKE || config.mean_assets < 1) {
+        usage("(out of range)");
+    }
+    return config;
+}
+
+
+/**
+* Names of the simulated accounts, a prefix followed by the index in base 26
+*/
+static name indexed_name(const std::string &prefix, uint64_t index, int digits) {
+    std::string suffix(digits, 'a');
+    for (int i = digits - 1; i >= 0; i--) {
+        suffix[i] = (char) ('a' + index % 26);
+        index /= 26;
+    }
+    return name((prefix + suffix).c_str());
+}
+
+
+/**
+* Fails the simulation if an action failed
+*/
+static void require_ok(const std::string &action_name, const extractor_host::action_result &result) {
+    if (!result.succeeded) {
+        std::fprintf(stderr, "%s failed: %s\n", action_name.c_str(), result.error.c_str());
+        std::exit(1);
+    }
+}
+
+
+class load_simulator {
+public:
+    explicit load_simulator(const workload_config &config) : config(config), random(config.seed) {
+        host.push(SELF, CALL(init()));
+        host.push(SELF, CALL(addsegment(time_point_sec(host.now()), asset(1000000000, APOC))));
+
+        double total_weight = 0;
+        for (uint64_t i = 0; i < config.collections; i++) {
+            name collection_name = indexed_name("simcoll", i, 2);
+            host.create_collection(collection_name, name("author"));
+            host.create_template(collection_name, 1, true);
+            require_ok("setcollrate", host.push(SELF, CALL(setcollrate(collection_name, 100))));
+            collection_names.push_back(collection_name);
+            total_weight += 1 / std::pow((double) (i + 1), config.skew);
+            cumulative_weights.push_back(total_weight);
+        }
+    }
+
+    void run() {
+        for (uint64_t i = 0; i < config.stakers; i++) {
+            push_stake(indexed_name("stk", i, 5), false);
+            host.advance(1);
+        }
+
+        uint64_t mix_total = 0;
+        for (uint64_t ratio : config.mix) {
+            mix_total += ratio;
+        }
+        for (uint64_t op = 0; op < config.ops && mix_total != 0; op++) {
+            uint64_t pick = random.below(mix_total);
+            size_t kind = 0;
+            while (pick >= config.mix[kind]) {
+                pick -= config.mix[kind];
+                kind++;
+            }
+            if (active_stakes.empty() || kind < 2) {
+                push_stake(indexed_name("stk", random.below(config.stakers), 5), kind == 1);
+            } else if (kind == 2) {
+                push_unstake();
+            } else if (kind == 3) {
+                simulated_stake stake = active_stakes[random.below(active_stakes.size())];
+                record("claimstake", host.push(stake.owner, CALL(claimstake(stake.stake_id))));
+            } else {
+                push_claim();
+            }
+            host.advance(1);
+        }
+    }
+
+    void report_latencies() {
+        std::printf("%-24s %9s %9s %9s %9s %9s %9s %9s\n",
+            "action", "count", "p50_us", "p90_us", "p99_us", "max_us", "reads", "writes");
+        for (auto &[action_name, action] : costs) {
+            std::vector <uint64_t> &nanoseconds = action.nanoseconds;
+            std::sort(nanoseconds.begin(), nanoseconds.end());
+            auto percentile_us = [&](double percentile) {
+                size_t rank = (size_t) std::ceil(percentile / 100 * nanoseconds.size());
+                return nanoseconds[std::max <size_t>(rank, 1) - 1] / 1000.0;
+            };
+            std::printf("%-24s %9zu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                action_name.c_str(),
+                nanoseconds.size(),
+                percentile_us(50),
+                percentile_us(90),
+                percentile_us(99),
+                percentile_us(100),
+                (double) action.reads / nanoseconds.size(),
+                (double) action.writes / nanoseconds.size());
+        }
+        if (skipped_claims != 0) {
+            std::printf("%llu claims were skipped, their stakers had no balance\n",
+                (unsigned long long) skipped_claims);
+        }
+    }
+
+    void report_ram() {
+        struct ram_total {
+            int64_t rows = 0;
+            int64_t bytes = 0;
+        };
+        std::map <std::tuple <std::string, std::string, std::string>, ram_total> ram_by_part = {};
+        std::map <std::string, int64_t> bytes_by_payer = {};
+        for (const auto &[key, usage] : emulator::state().ram) {
+            if (key.code != SELF || usage.rows == 0) {
+                continue;
+            }
+            std::string payer = key.payer == SELF ? "contract" : "stakers";
+            ram_total &total = ram_by_part[{key.table.to_string(), key.part, payer}];
+            total.rows += usage.rows;
+            total.bytes += usage.bytes;
+            bytes_by_payer[payer] += usage.bytes;
+        }
+
+        std::printf("\n%-16s %-24s %-10s %10s %12s %12s\n", "table", "part", "payer", "rows", "bytes", "bytes/staker");
+        for (const auto &[part, total] : ram_by_part) {
+            std::printf("%-16s %-24s %-10s %10lld %12lld %12.1f\n",
+                std::get <0>(part).c_str(),
+                std::get <1>(part).c_str(),
+                std::get <2>(part).c_str(),
+                (long long) total.rows,
+                (long long) total.bytes,
+                (double) total.bytes / config.stakers);
+        }
+        for (const auto &[payer, bytes] : bytes_by_payer) {
+            std::printf("%-16s %-24s %-10s %10s %12lld %12.1f\n", "total", "", payer.c_str(), "",
+                (long long) bytes, (double) bytes / config.stakers);
+        }
+    }
+
+private:
+    void record(const std::string &action_name, const extractor_host::action_result &result) {
+        require_ok(action_name, result);
+        action_costs &action = costs[action_name];
+        action.nanoseconds.push_back(result.nanoseconds);
+        action.reads += result.stats.reads;
+        action.writes += result.stats.writes;
+    }
+
+    name pick_collection() {
+        double pick = random.unit() * cumulative_weights.back();
+        size_t index = std::upper_bound(cumulative_weights.begin(), cumulative_weights.end(), pick)
+            - cumulative_weights.begin();
+        return collection_names[std::min(index, collection_names.size() - 1)];
+    }
+
+    uint64_t pick_asset_count() {
+        //Geometric distribution on 1, 2, ... with the configured mean
+        double continue_probability = 1 - 1 / config.mean_assets;
+        uint64_t count = 1;
+        while (count < config.max_assets && random.unit() < continue_probability) {
+            count++;
+        }
+        return count;
+    }
+
+    void push_stake(name owner, bool custodial) {
+        name collection_name = pick_collection();
+        std::vector <uint64_t> asset_ids = {};
+        for (uint64_t i = pick_asset_count(); i > 0; i--) {
+            host.mint_asset(owner, next_asset_id, collection_name, 1);
+            asset_ids.push_back(next_asset_id++);
+        }
+
+        if (!custodial) {
+            record("stake", host.push(owner, CALL(stake(owner, asset_ids))));
+        } else {
+            record("openstake", host.push(owner, CALL(openstake(owner, asset_ids))));
+        }
+        uint64_t stake_id = host.last_stake_id();
+        if (custodial) {
+            record("receive_asset_transfer",
+                host.transfer_assets(owner, SELF, asset_ids, "stake:" + std::to_string(stake_id)));
+        }
+        active_stakes.push_back({stake_id, owner});
+    }
+
+    void push_unstake() {
+        size_t index = random.below(active_stakes.size());
+        simulated_stake stake = active_stakes[index];
+        active_stakes[index] = active_stakes.back();
+        active_stakes.pop_back();
+        record("unstake", host.push(stake.owner, CALL(unstake(stake.stake_id))));
+    }
+
+    void push_claim() {
+        name owner = active_stakes[random.below(active_stakes.size())].owner;
+        int64_t balance = host.balance_of(owner);
+        if (balance == 0) {
+            skipped_claims++;
+            return;
+        }
+        record("claim", host.push(owner, CALL(claim(owner, asset(balance, APOC)))));
+    }
+
+    const workload_config config;
+    workload_random random;
+    extractor_host host;
+
+    std::vector <name> collection_names = {};
+    std::vector <double> cumulative_weights = {};
+    std::vector <simulated_stake> active_stakes = {};
+    uint64_t next_asset_id = FIRST_ASSET_ID;
+
+    std::map <std::string, action_costs> costs = {};
+    uint64_t skipped_claims = 0;
+};
+
+
+int main(int argc, char **argv) {
+    workload_config config = parse_arguments(argc, argv);
+    std::printf("%llu stakers, %llu actions, %llu collections with skew %.2f, %.2f mean and %llu max assets per stake\n\n",
+        (unsigned long long) config.stakers,
+        (unsigned long long) config.ops,
+        (unsigned long long) config.collections,
+        config.skew,
+        config.mean_assets,
+        (unsigned long long) config.max_assets);
+
+    load_simulator simulator(config);
+    simulator.run();
+    simulator.report_latencies();
+    simulator.report_ram();
+    return 0;
+}
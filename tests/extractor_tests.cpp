@@ -0,0 +1,862 @@
+/*
+
+Behaviour tests of the extractor contract, run on the host harness.
+
+*/
+
+#include "extractor_host.hpp"
+#include "host_test.hpp"
+
+static constexpr name SELF = extractor_host::SELF;
+static constexpr name ALICE = name("alice");
+static constexpr name BOB = name("bob");
+static constexpr name COLLECTION = name("coll");
+static constexpr symbol APOC = extractor_host::APOC_SYMBOL;
+static constexpr symbol WAX = symbol(symbol_code("WAX"), 8);
+
+//Length of an accrual period with the default config
+static constexpr uint32_t PERIOD = 720 * 60;
+static constexpr int64_t EMISSION_PER_PERIOD = 1000000;
+
+
+/**
+* Initializes the contract with a constant emission that starts now, and creates a collection, whitelisted
+* with a weight of 100, with a transferable template 1 and a non transferable template 2
+*/
+static void setup(extractor_host &host) {
+    host.create_collection(COLLECTION, name("author"));
+    host.create_template(COLLECTION, 1, true);
+    host.create_template(COLLECTION, 2, false);
+
+    REQUIRE_OK(host.push(SELF, CALL(init())));
+    REQUIRE_OK(host.push(SELF, CALL(addsegment(time_point_sec(host.now()), asset(EMISSION_PER_PERIOD, APOC)))));
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(COLLECTION, 100))));
+}
+
+static void mint_assets(extractor_host &host, name owner, uint64_t first_asset_id, uint64_t count,
+    name collection_name = COLLECTION, int32_t template_id = 1) {
+    for (uint64_t asset_id = first_asset_id; asset_id < first_asset_id + count; asset_id++) {
+        host.mint_asset(owner, asset_id, collection_name, template_id);
+    }
+}
+
+
+TEST(stakes_earn_the_emission_proportionally_to_their_units) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 10);
+    host.mint_asset(ALICE, 200, COLLECTION, 2);
+
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {101, 100, 103}))));
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {103, 104}))), "You have already staked at least one");
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {200}))), "not transferable");
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {150}))), "does not own");
+    REQUIRE_FAILS(host.push(BOB, CALL(stake(ALICE, {104}))), "missing authority of alice");
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {104}))));
+
+    REQUIRE(host.stakes().get(1).units == 300);
+    REQUIRE(host.stakes().get(2).units == 100);
+    REQUIRE(host.rewards().total_units == 400);
+
+    host.advance(2 * PERIOD);
+    REQUIRE_OK(host.push(ALICE, CALL(claimstake(1))));
+    REQUIRE_OK(host.push(ALICE, CALL(claimstake(2))));
+    REQUIRE(host.balance_of(ALICE) == 2 * EMISSION_PER_PERIOD);
+
+    REQUIRE_FAILS(host.push(BOB, CALL(unstake(1))), "The stake is not invalid");
+    REQUIRE_OK(host.push(ALICE, CALL(unstake(1))));
+    REQUIRE(host.stakes().find(1) == host.stakes().end());
+    REQUIRE(host.stakedassets().find(100) == host.stakedassets().end());
+    REQUIRE(host.rewards().total_units == 100);
+
+    auto claimed = host.push(ALICE, CALL(claim(ALICE, asset(2 * EMISSION_PER_PERIOD, APOC))));
+    REQUIRE_OK(claimed);
+    REQUIRE(extractor_host::count_actions(claimed, name("apocalyptics"), name("transfer")) == 1);
+    REQUIRE(host.balance_of(ALICE) == 0);
+}
+
+
+TEST(emission_before_the_first_stake_is_not_distributed) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 1);
+    mint_assets(host, BOB, 200, 1);
+
+    host.advance(3 * PERIOD);
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {100}))));
+    host.advance(2 * PERIOD);
+    REQUIRE_OK(host.push(BOB, CALL(stake(BOB, {200}))));
+    host.advance(2 * PERIOD);
+
+    REQUIRE_OK(host.push(ALICE, CALL(claimstake(1))));
+    REQUIRE_OK(host.push(BOB, CALL(claimstake(2))));
+    REQUIRE(host.balance_of(ALICE) == 3 * EMISSION_PER_PERIOD);
+    REQUIRE(host.balance_of(BOB) == EMISSION_PER_PERIOD);
+}
+
+
+TEST(stakes_created_mid_period_only_earn_from_their_creation) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 1);
+    mint_assets(host, BOB, 200, 1);
+
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {100}))));
+    host.advance(PERIOD - 60);
+    //Staking right before the end of a period doesn't earn a share of the whole period
+    REQUIRE_OK(host.push(BOB, CALL(stake(BOB, {200}))));
+    REQUIRE(host.pending_rewards(2) == 0);
+    host.advance(60);
+    REQUIRE(host.pending_rewards(2) == EMISSION_PER_PERIOD * 30 / PERIOD);
+
+    //Rewards accrue every second, not only in full periods
+    host.advance(PERIOD / 2);
+    REQUIRE_OK(host.push(ALICE, CALL(claimstake(1))));
+    REQUIRE_OK(host.push(BOB, CALL(claimstake(2))));
+    REQUIRE(host.balance_of(ALICE) == EMISSION_PER_PERIOD * (PERIOD - 60) / PERIOD
+                                      + EMISSION_PER_PERIOD * (60 + PERIOD / 2) / PERIOD / 2);
+    REQUIRE(host.balance_of(BOB) == EMISSION_PER_PERIOD * (60 + PERIOD / 2) / PERIOD / 2);
+}
+
+
+TEST(invalid_stakes_forfeit_their_rewards) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 6);
+
+    REQUIRE_OK(host.push(ALICE, CALL(stakemany(ALICE, {{100, 101}, {102}, {103}}))));
+    host.advance(PERIOD);
+    REQUIRE_OK(host.transfer_assets(ALICE, BOB, {101, 102, 103}, ""));
+
+    REQUIRE_FAILS(host.push(ALICE, CALL(claimstake(1))), "The stake is invalid");
+    REQUIRE_FAILS(host.push(ALICE, CALL(addtostake(1, {104}))), "The stake is invalid");
+    REQUIRE_FAILS(host.push(ALICE, CALL(removefromstake(1, {100}))), "The stake is invalid");
+
+    //Restaking an asset of an invalid stake removes that stake, without settling it
+    REQUIRE_OK(host.push(BOB, CALL(stake(BOB, {101}))));
+    REQUIRE(host.stakes().find(1) == host.stakes().end());
+    //Unstaking an invalid stake, by anyone, doesn't settle it either
+    REQUIRE_OK(host.push(BOB, CALL(unstake(2))));
+    REQUIRE_OK(host.push(ALICE, CALL(unstake(3))));
+    REQUIRE(host.balance_of(ALICE) == 0);
+    REQUIRE(host.rewards().total_units == 100);
+}
+
+
+TEST(stakemany_creates_one_stake_per_group) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 300, 20);
+
+    auto overlapping = host.push(ALICE, CALL(stakemany(ALICE, {{300, 301}, {301, 302}})));
+    REQUIRE_FAILS(overlapping, "You have already staked at least one");
+    REQUIRE(host.stakes().begin() == host.stakes().end());
+
+    auto result = host.push(ALICE, CALL(stakemany(ALICE, {{300, 301}, {302}, {303, 304, 305}})));
+    REQUIRE_OK(result);
+    REQUIRE(extractor_host::count_actions(result, SELF, name("lognewstakes")) == 1);
+
+    size_t stakes = 0;
+    for (const auto &stake : host.stakes()) {
+        REQUIRE(stake.owner == ALICE);
+        stakes++;
+    }
+    REQUIRE(stakes == 3);
+    REQUIRE(host.stakes().get(3).get_asset_ids() == (std::vector <uint64_t>{303, 304, 305}));
+}
+
+
+TEST(tokens_are_deposited_and_withdrawn_through_the_registry) {
+    extractor_host host;
+    setup(host);
+
+    REQUIRE_OK(host.transfer_tokens(name("apocalyptics"), ALICE, SELF, asset(50000, APOC), "claim"));
+    REQUIRE_FAILS(host.transfer_tokens(name("fakeapoc"), ALICE, SELF, asset(50000, APOC), "claim"),
+        "The transferred token is not supported");
+    REQUIRE_FAILS(host.transfer_tokens(name("apocalyptics"), ALICE, SELF, asset(1, APOC), "deposit"), "invalid memo");
+    REQUIRE(host.balance_of(ALICE) == 50000);
+
+    REQUIRE_OK(host.push(ALICE, CALL(claim(ALICE, asset(20000, APOC)))));
+    REQUIRE(host.balance_of(ALICE) == 30000);
+    REQUIRE_FAILS(host.push(ALICE, CALL(claim(ALICE, asset(30001, APOC)))), "lower than the specified quantity");
+    REQUIRE_FAILS(host.push(ALICE, CALL(claim(ALICE, asset(1, WAX)))), "does not have a balance");
+
+    REQUIRE_FAILS(host.transfer_tokens(name("eosio.token"), ALICE, SELF, asset(1, WAX), "claim"), "not supported");
+    REQUIRE_OK(host.push(SELF, CALL(addtoken(name("eosio.token"), WAX))));
+    REQUIRE_OK(host.transfer_tokens(name("eosio.token"), ALICE, SELF, asset(7, WAX), "claim"));
+    REQUIRE(host.balance_of(ALICE, WAX.code()) == 7);
+
+    REQUIRE_FAILS(host.push(SELF, CALL(retiretoken(APOC.code()))), "The apoc token can't be retired");
+    REQUIRE_OK(host.push(SELF, CALL(retiretoken(WAX.code()))));
+    REQUIRE_FAILS(host.transfer_tokens(name("eosio.token"), ALICE, SELF, asset(1, WAX), "claim"), "not supported");
+    //Retired tokens can still be withdrawn
+    REQUIRE_OK(host.push(ALICE, CALL(claim(ALICE, asset(7, WAX)))));
+}
+
+
+TEST(legacy_balances_are_migrated_in_batches) {
+    extractor_host host;
+    setup(host);
+    name dave = name("dave");
+
+    extractor_host::balances_t legacy_balances(SELF, SELF.value);
+    legacy_balances.emplace(SELF, [&](auto &_balance) {
+        _balance.owner = dave;
+        _balance.quantities = {asset(5, APOC), asset(7, WAX)};
+    });
+    legacy_balances.emplace(SELF, [&](auto &_balance) {
+        _balance.owner = name("erin");
+        _balance.quantities = {asset(9, APOC)};
+    });
+
+    REQUIRE_OK(host.push(SELF, CALL(startmigr(MIGRATION_STEP_ACCOUNTS))));
+    REQUIRE_FAILS(host.push(dave, CALL(claim(dave, asset(3, APOC)))), "The accounts table is being migrated");
+
+    REQUIRE_OK(host.push(SELF, CALL(migrate(1))));
+    REQUIRE(host.balance_of(dave) == 5);
+    REQUIRE(host.balance_of(dave, WAX.code()) == 7);
+    REQUIRE(legacy_balances.begin() != legacy_balances.end());
+
+    REQUIRE_OK(host.push(SELF, CALL(migrate(5))));
+    REQUIRE(host.balance_of(name("erin")) == 9);
+    REQUIRE(legacy_balances.begin() == legacy_balances.end());
+    REQUIRE_FAILS(host.push(SELF, CALL(migrate(5))), "No migration step is running");
+
+    REQUIRE_OK(host.push(dave, CALL(claim(dave, asset(3, APOC)))));
+    REQUIRE(host.balance_of(dave) == 2);
+}
+
+
+TEST(log_mode_print_does_not_send_inline_actions) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 400, 2);
+
+    auto inline_logged = host.push(ALICE, CALL(stake(ALICE, {400})));
+    REQUIRE_OK(inline_logged);
+    REQUIRE(extractor_host::count_actions(inline_logged, SELF, name("lognewstake")) == 1);
+
+    REQUIRE_OK(host.push(SELF, CALL(setlogmode(LOG_MODE_PRINT))));
+    auto print_logged = host.push(ALICE, CALL(stake(ALICE, {401})));
+    REQUIRE_OK(print_logged);
+    REQUIRE(print_logged.actions.empty());
+    REQUIRE(print_logged.console.rfind("lognewstake:", 0) == 0);
+
+    REQUIRE_FAILS(host.push(SELF, CALL(setlogmode(3))), "Invalid log mode");
+}
+
+
+TEST(config_rows_without_a_log_mode_log_inline) {
+    extractor_host host;
+    //Config row as written before the log mode was added
+    std::vector <char> legacy_bytes = pack(std::make_tuple(std::string("1.3.2"), (uint64_t) 5, (uint32_t) 1440,
+        (uint32_t) 720, name("apocalyptics"), APOC, name("atomicassets")));
+    extractor_host::config_s legacy_config = unpack <extractor_host::config_s>(legacy_bytes);
+    REQUIRE(!legacy_config.log_mode.has_value());
+    REQUIRE(legacy_config.get_log_mode() == LOG_MODE_INLINE);
+    extractor_host::config_t(SELF, SELF.value).set(legacy_config, SELF);
+
+    setup(host);
+    REQUIRE_OK(host.push(SELF, CALL(startmigr(MIGRATION_STEP_COUNTERS))));
+    REQUIRE_OK(host.push(SELF, CALL(migrate(1))));
+    REQUIRE(pack_size(extractor_host::config_t(SELF, SELF.value).get()) == legacy_bytes.size());
+
+    mint_assets(host, ALICE, 400, 2);
+    auto inline_logged = host.push(ALICE, CALL(stake(ALICE, {400})));
+    REQUIRE_OK(inline_logged);
+    REQUIRE(extractor_host::count_actions(inline_logged, SELF, name("lognewstake")) == 1);
+    REQUIRE(host.stakes().begin()->stake_id == 5);
+
+    REQUIRE_OK(host.push(SELF, CALL(setlogmode(LOG_MODE_NONE))));
+    REQUIRE(extractor_host::config_t(SELF, SELF.value).get().get_log_mode() == LOG_MODE_NONE);
+    auto not_logged = host.push(ALICE, CALL(stake(ALICE, {401})));
+    REQUIRE_OK(not_logged);
+    REQUIRE(not_logged.actions.empty());
+}
+
+
+TEST(asset_ids_are_packed_canonically) {
+    std::vector <uint64_t> asset_ids = {1099511627776 + 500, 1099511627776 + 3, 1099511627776 + 4, UINT64_MAX, 0,
+        128, 127};
+    std::vector <uint8_t> packed = pack_asset_ids(asset_ids);
+
+    std::vector <uint64_t> sorted_asset_ids = asset_ids;
+    std::sort(sorted_asset_ids.begin(), sorted_asset_ids.end());
+    REQUIRE(unpack_asset_ids(packed) == sorted_asset_ids);
+
+    std::vector <uint64_t> reordered = {128, 127, UINT64_MAX, 0, 1099511627776 + 4, 1099511627776 + 3,
+        1099511627776 + 500};
+    REQUIRE(pack_asset_ids(reordered) == packed);
+
+    //Assets minted together are one byte per id apart
+    std::vector <uint64_t> minted_together = {};
+    for (uint64_t i = 0; i < 10; i++) {
+        minted_together.push_back(1099511627776 + i);
+    }
+    REQUIRE(pack_asset_ids(minted_together).size() == 6 + 9);
+}
+
+
+TEST(sweep_removes_invalid_stakes_in_batches) {
+    extractor_host host;
+    setup(host);
+    name gus = name("gus");
+    mint_assets(host, gus, 500, 6);
+
+    REQUIRE_OK(host.push(gus, CALL(stakemany(gus, {{500}, {501, 502}, {503}, {504, 505}}))));
+    REQUIRE_OK(host.transfer_assets(gus, BOB, {502, 504}, ""));
+
+    //The progress is reported even if nothing else is logged
+    REQUIRE_OK(host.push(SELF, CALL(setlogmode(LOG_MODE_NONE))));
+    for (int i = 0; i < 3; i++) {
+        auto swept = host.push(BOB, CALL(sweep(3)));
+        REQUIRE_OK(swept);
+        REQUIRE(extractor_host::count_actions(swept, SELF, name("logsweep")) == 1);
+    }
+
+    std::vector <uint64_t> remaining_stake_ids = {};
+    for (const auto &stake : host.stakes()) {
+        remaining_stake_ids.push_back(stake.stake_id);
+    }
+    REQUIRE(remaining_stake_ids == (std::vector <uint64_t>{1, 3}));
+    REQUIRE(host.stakedassets().find(501) == host.stakedassets().end());
+    REQUIRE(host.stakedassets().find(500) != host.stakedassets().end());
+    REQUIRE(host.rewards().total_units == 200);
+    REQUIRE_FAILS(host.push(BOB, CALL(sweep(0))), "max_rows needs to be at least 1");
+}
+
+
+TEST(stakes_are_capped) {
+    extractor_host host;
+    setup(host);
+    name ivy = name("ivy");
+
+    std::vector <uint64_t> asset_ids = {};
+    for (uint64_t asset_id = 600; asset_id <= MAX_ASSETS_PER_STAKE + 600; asset_id++) {
+        host.mint_asset(ivy, asset_id, COLLECTION, 1);
+        asset_ids.push_back(asset_id);
+    }
+    REQUIRE_FAILS(host.push(ivy, CALL(stake(ivy, asset_ids))), "A stake can contain at most");
+
+    asset_ids.pop_back();
+    std::reverse(asset_ids.begin(), asset_ids.end());
+    REQUIRE_OK(host.push(ivy, CALL(stake(ivy, asset_ids))));
+
+    std::reverse(asset_ids.begin(), asset_ids.end());
+    REQUIRE(host.stakes().get(1).owner == ivy);
+    REQUIRE(host.stakes().get(1).get_asset_ids() == asset_ids);
+}
+
+
+TEST(assets_are_added_to_and_removed_from_stakes) {
+    extractor_host host;
+    setup(host);
+    name jo = name("jo");
+    mint_assets(host, jo, 800, 10);
+
+    REQUIRE_OK(host.push(jo, CALL(stake(jo, {800, 801}))));
+    REQUIRE_FAILS(host.push(jo, CALL(addtostake(1, {801, 802}))), "You have already staked at least one");
+    REQUIRE_FAILS(host.push(BOB, CALL(addtostake(1, {802}))), "missing authority of jo");
+    REQUIRE_OK(host.push(jo, CALL(addtostake(1, {805, 802}))));
+    REQUIRE(host.stakes().get(1).units == 400);
+    REQUIRE(host.stakes().get(1).get_asset_ids() == (std::vector <uint64_t>{800, 801, 802, 805}));
+
+    REQUIRE_FAILS(host.push(jo, CALL(removefromstake(1, {803}))), "not part of the stake");
+    REQUIRE_FAILS(host.push(jo, CALL(removefromstake(1, {800, 800}))), "not part of the stake");
+    REQUIRE_FAILS(host.push(jo, CALL(removefromstake(1, {800, 801, 802, 805}))), "A stake can't be emptied");
+    REQUIRE_OK(host.push(jo, CALL(removefromstake(1, {801, 805}))));
+
+    REQUIRE(host.stakes().get(1).get_asset_ids() == (std::vector <uint64_t>{800, 802}));
+    REQUIRE(host.stakes().get(1).units == 200);
+    REQUIRE(host.rewards().total_units == 200);
+    REQUIRE(host.stakedassets().find(801) == host.stakedassets().end());
+    REQUIRE(host.stakedassets().get(802).stake_id == 1);
+}
+
+
+TEST(fixed_point_math_is_checked) {
+    using namespace fixedpoint;
+    REQUIRE(mul_div(10, 1, 3) == 3);
+    REQUIRE(mul_div(UINT64_MAX, UINT64_MAX, UINT64_MAX) == UINT64_MAX);
+    REQUIRE(to_uint64(UINT64_MAX) == UINT64_MAX);
+    REQUIRE(to_amount(asset::max_amount) == asset::max_amount);
+
+    auto fails = [](auto &&compute) {
+        try {
+            compute();
+        } catch (const emulator::assertion_failure &) {
+            return true;
+        }
+        return false;
+    };
+    REQUIRE(fails([] { checked_mul(UINT128_MAXIMUM, 2); }));
+    REQUIRE(fails([] { fixedpoint::div(1, 0); }));
+    REQUIRE(fails([] { to_uint64((uint128_t) UINT64_MAX + 1); }));
+    REQUIRE(fails([] { to_amount((uint128_t) asset::max_amount + 1); }));
+}
+
+
+TEST(emission_schedule_is_piecewise_constant) {
+    extractor_host host;
+    setup(host);
+    uint32_t now = host.now();
+
+    REQUIRE_FAILS(host.push(SELF, CALL(addsegment(time_point_sec(now - 1), asset(1, APOC)))), "start in the past");
+    REQUIRE_OK(host.push(SELF, CALL(addsegment(time_point_sec(now + PERIOD), asset(500000, APOC)))));
+    REQUIRE_FAILS(host.push(SELF, CALL(addsegment(time_point_sec(now + PERIOD), asset(1, APOC)))),
+        "start after the last segment");
+    REQUIRE_OK(host.push(SELF, CALL(addsegment(time_point_sec(now + 3 * PERIOD + PERIOD / 2), asset(0, APOC)))));
+
+    //1 period at 1000000, 2.5 periods at 500000, then nothing
+    uint128_t emitted = host.cumulative_emission(now + 10 * PERIOD) - host.cumulative_emission(now);
+    REQUIRE(emitted / PERIOD == 2250000);
+
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(COLLECTION, 150))));
+    REQUIRE(host.collection_weight(COLLECTION) == 150);
+}
+
+
+TEST(only_whitelisted_collections_can_be_staked) {
+    extractor_host host;
+    setup(host);
+    name othercoll = name("othercoll");
+    host.create_template(othercoll, 1, true);
+    host.mint_asset(ALICE, 100, othercoll, 1);
+    mint_assets(host, ALICE, 200, 3);
+
+    REQUIRE(host.collection_weight(othercoll) == 0);
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {100}))), "not whitelisted");
+    REQUIRE_FAILS(host.push(ALICE, CALL(openstake(ALICE, {100}))), "not whitelisted");
+
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {200}))));
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(COLLECTION, 0))));
+    REQUIRE(host.collection_weight(COLLECTION) == 0);
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(COLLECTION, 0))));
+    //Delisting keeps existing stakes, but no assets can be staked anymore
+    REQUIRE(host.stakes().get(1).units == 100);
+    REQUIRE_FAILS(host.push(ALICE, CALL(addtostake(1, {201}))), "not whitelisted");
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {202}))), "not whitelisted");
+}
+
+
+TEST(twap_is_computed_from_the_price_buffer) {
+    extractor_host host;
+    setup(host);
+    name pair = name("waxpusd");
+    host.create_pair(pair);
+
+    REQUIRE_FAILS(host.push(SELF, CALL(setpricepair(name("nopair"), 60, 300))), "does not exist");
+    REQUIRE_FAILS(host.push(SELF, CALL(setpricepair(pair, 60, 0))), "maximum datapoint age must be positive");
+    REQUIRE_OK(host.push(SELF, CALL(setpricepair(pair, 60, 300))));
+    REQUIRE_FAILS(host.push(BOB, CALL(pokeprice())), "does not have any datapoints");
+
+    //A stalled oracle is not sampled
+    host.add_datapoint(pair, 1, 100, host.now() - 301);
+    REQUIRE_FAILS(host.push(BOB, CALL(pokeprice())), "datapoint of the delphi pair is too old");
+    host.add_datapoint(pair, 2, 100, host.now() - 300);
+    REQUIRE_OK(host.push(BOB, CALL(pokeprice())));
+    REQUIRE_FAILS(host.push(BOB, CALL(pokeprice())), "sampled too recently");
+
+    host.advance(100);
+    host.add_datapoint(pair, 3, 200, host.now());
+    REQUIRE_OK(host.push(BOB, CALL(pokeprice())));
+    host.advance(100);
+
+    //100 seconds at 100, then 100 seconds at 200
+    REQUIRE(host.read(CALL(gettwap(200))) == 150);
+    REQUIRE(host.read(CALL(gettwap(50))) == 200);
+    bool uncovered_rejected = false;
+    try {
+        host.read(CALL(gettwap(201)));
+    } catch (const emulator::assertion_failure &) {
+        uncovered_rejected = true;
+    }
+    REQUIRE(uncovered_rejected);
+
+    //Once the buffer is full, the oldest samples are overwritten
+    for (uint64_t i = 0; i < PRICE_BUFFER_SIZE + 10; i++) {
+        host.advance(60);
+        host.add_datapoint(pair, 10 + i, 300, host.now());
+        REQUIRE_OK(host.push(BOB, CALL(pokeprice())));
+    }
+    REQUIRE(host.read(CALL(gettwap(600))) == 300);
+}
+
+
+TEST(only_assets_of_transferable_templates_can_be_staked) {
+    extractor_host host;
+    setup(host);
+    name tmplcoll = name("tmplcoll");
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(tmplcoll, 100))));
+    host.create_template(tmplcoll, 70, true);
+    host.create_template(tmplcoll, 3, true);
+    host.create_template(tmplcoll, 4, false);
+    host.mint_asset(ALICE, 7000, tmplcoll, 70);
+    host.mint_asset(ALICE, 7001, tmplcoll, 3);
+    host.mint_asset(ALICE, 7002, tmplcoll, 4);
+
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {7000, 7001}))));
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {7002}))), "not transferable");
+    host.mint_asset(ALICE, 7003, tmplcoll, 5);
+    REQUIRE_FAILS(host.push(ALICE, CALL(stake(ALICE, {7003}))), "template of at least one of the assets does not exist");
+}
+
+
+TEST(counter_ranges_are_reserved_with_one_write) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 3);
+    REQUIRE_OK(host.push(ALICE, CALL(stakemany(ALICE, {{100}, {101}, {102}}))));
+
+    std::vector <extractor_host::COUNTER_RANGE> ranges = host.read(CALL(getcounters()));
+    REQUIRE(ranges.size() == 1);
+    REQUIRE(ranges[0].counter_name == name("stake") && ranges[0].start_id == 1 && ranges[0].end_id == 3);
+
+    extractor_host::COUNTER_RANGE range;
+    auto reserved = host.push(SELF, [&](extractor &contract) {
+        range = contract.reserve_counter_range(name("stake"), 5);
+    });
+    REQUIRE_OK(reserved);
+    REQUIRE(range.start_id == 4 && range.end_id == 8);
+    REQUIRE(reserved.stats.reads == 1 && reserved.stats.writes == 1);
+}
+
+
+TEST(custodial_stakes_are_opened_and_activated_by_transfers) {
+    extractor_host host;
+    setup(host);
+    name gus = name("gus");
+    mint_assets(host, gus, 2000, 4);
+
+    REQUIRE_OK(host.push(gus, CALL(stake(gus, {2000}))));
+    REQUIRE_FAILS(host.push(gus, CALL(openstake(gus, {2000, 2001}))), "You have already staked at least one");
+    REQUIRE_OK(host.push(gus, CALL(unstake(1))));
+
+    //The stake's RAM is paid by the owner when opening it, and the pending stake earns nothing
+    int64_t contract_ram = emulator::ram_of(SELF);
+    REQUIRE_OK(host.push(gus, CALL(openstake(gus, {2000, 2001, 2002}))));
+    uint64_t stake_id = host.last_stake_id();
+    REQUIRE(emulator::ram_of(SELF) == contract_ram);
+    REQUIRE(host.stakes().get(stake_id).is_pending());
+    REQUIRE(host.stakes().get(stake_id).units == 0);
+    REQUIRE(host.rewards().total_units == 0);
+    REQUIRE(host.stakedassets().get(2001).units == 100);
+
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2000, 2001}, "stake"), "invalid memo");
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2000}, "stake:x"), "The memo needs to be");
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2000}, "stake:18446744073709551616"), "The memo needs to be");
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2000}, "stake:99"), "No stake with this stake_id exists");
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2000, 2001}, "stake:" + std::to_string(stake_id)),
+        "exactly the assets of the stake");
+    host.mint_asset(BOB, 2100, COLLECTION, 1);
+    REQUIRE_FAILS(host.transfer_assets(BOB, SELF, {2100}, "stake:" + std::to_string(stake_id)), "your own stakes");
+    REQUIRE_FAILS(host.push(gus, CALL(removefromstake(stake_id, {2001}))), "before it is activated");
+    REQUIRE(host.owns_asset(gus, 2000));
+
+    auto activated = host.transfer_assets(gus, SELF, {2002, 2000, 2001}, "stake:" + std::to_string(stake_id));
+    REQUIRE_OK(activated);
+    //The notification charges no RAM to the contract, the assets only move between the atomicassets scopes
+    REQUIRE(emulator::ram_of(SELF) == contract_ram);
+    REQUIRE(!host.stakes().get(stake_id).is_pending());
+    REQUIRE(host.stakes().get(stake_id).units == 300);
+    REQUIRE(host.rewards().total_units == 300);
+    REQUIRE(host.owns_asset(SELF, 2000) && !host.owns_asset(gus, 2000));
+    REQUIRE_FAILS(host.transfer_assets(gus, SELF, {2003}, "stake:" + std::to_string(stake_id)),
+        "custodial stakes opened with openstake");
+
+    //Active custodial stakes are never invalid
+    REQUIRE_OK(host.push(BOB, CALL(sweep(1000))));
+    REQUIRE(host.stakes().find(stake_id) != host.stakes().end());
+
+    auto removed = host.push(gus, CALL(removefromstake(stake_id, {2001})));
+    REQUIRE_OK(removed);
+    REQUIRE(extractor_host::count_actions(removed, extractor_host::ATOMICASSETS, name("transfer")) == 1);
+    REQUIRE(host.owns_asset(gus, 2001));
+    REQUIRE(host.stakes().get(stake_id).units == 200);
+
+    REQUIRE_FAILS(host.push(BOB, CALL(unstake(stake_id))), "The stake is not invalid");
+    int64_t gus_ram = emulator::ram_of(gus);
+    REQUIRE_OK(host.push(gus, CALL(unstake(stake_id))));
+    REQUIRE(host.owns_asset(gus, 2000) && host.owns_asset(gus, 2002));
+    REQUIRE(host.stakes().find(stake_id) == host.stakes().end());
+    REQUIRE(emulator::ram_of(gus) < gus_ram);
+}
+
+
+TEST(pending_custodial_stakes_are_released_without_transfers) {
+    extractor_host host;
+    setup(host);
+    name gus = name("gus");
+    mint_assets(host, gus, 2000, 2);
+
+    int64_t gus_ram = emulator::ram_of(gus);
+    REQUIRE_OK(host.push(gus, CALL(openstake(gus, {2000}))));
+    REQUIRE_OK(host.push(gus, CALL(unstake(1))));
+    REQUIRE(emulator::ram_of(gus) == gus_ram);
+    REQUIRE(host.owns_asset(gus, 2000));
+
+    //A pending stake whose assets the owner no longer holds is invalid and can be swept
+    REQUIRE_OK(host.push(gus, CALL(openstake(gus, {2001}))));
+    REQUIRE_OK(host.transfer_assets(gus, BOB, {2001}, ""));
+    REQUIRE_OK(host.push(BOB, CALL(sweep(10))));
+    REQUIRE(host.stakes().begin() == host.stakes().end());
+}
+
+
+TEST(memo_ids_are_parsed_with_overflow_checks) {
+    auto parses = [](const std::string &digits, uint64_t expected) {
+        try {
+            return parse_uint64(digits, "invalid") == expected;
+        } catch (const emulator::assertion_failure &) {
+            return false;
+        }
+    };
+    REQUIRE(parses("0", 0));
+    REQUIRE(parses("42", 42));
+    REQUIRE(parses("18446744073709551615", UINT64_MAX));
+    REQUIRE(!parses("18446744073709551616", 0));
+    REQUIRE(!parses("99999999999999999999", 0));
+    REQUIRE(!parses("", 0));
+    REQUIRE(!parses("-1", 0));
+    REQUIRE(!parses("1 ", 0));
+}
+
+
+TEST(stakes_are_paginated_by_owner_and_collection) {
+    extractor_host host;
+    setup(host);
+    name quinn = name("quinn");
+    name pagecoll = name("pagecoll");
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(pagecoll, 100))));
+    host.create_template(pagecoll, 1, true);
+    mint_assets(host, quinn, 3000, 5, pagecoll);
+
+    for (uint64_t asset_id = 3000; asset_id < 3005; asset_id++) {
+        REQUIRE_OK(host.push(quinn, CALL(stake(quinn, {asset_id}))));
+    }
+
+    extractor_host::STAKES_PAGE first_page = host.read(CALL(getstakes(quinn, 0, 2)));
+    REQUIRE(first_page.stakes.size() == 2 && first_page.more);
+    extractor_host::STAKES_PAGE second_page = host.read(CALL(getstakes(quinn, first_page.next_stake_id, 2)));
+    extractor_host::STAKES_PAGE third_page = host.read(CALL(getstakes(quinn, second_page.next_stake_id, 2)));
+    REQUIRE(second_page.stakes.size() == 2 && third_page.stakes.size() == 1 && !third_page.more);
+    REQUIRE(third_page.stakes[0].asset_ids[0] == 3004 && third_page.stakes[0].owner == quinn);
+
+    REQUIRE(host.read(CALL(getcollstakes(pagecoll, 0, 100))).stakes.size() == 5);
+    REQUIRE(host.read(CALL(getstakes(name("nobody"), 0, 10))).stakes.empty());
+
+    REQUIRE_FAILS(host.push(SELF, CALL(startmigr(name("stakes")))), "Unknown migration step");
+}
+
+
+TEST(collection_stats_are_maintained_and_checked) {
+    extractor_host host;
+    setup(host);
+    name rae = name("rae");
+    name statcoll = name("statcoll");
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(statcoll, 100))));
+    host.create_template(statcoll, 1, true);
+    mint_assets(host, rae, 4000, 6, statcoll);
+
+    REQUIRE_OK(host.push(rae, CALL(stake(rae, {4000, 4001}))));
+    REQUIRE_OK(host.push(rae, CALL(stake(rae, {4002}))));
+    auto stats = [&]() { return host.collstats().get(statcoll.value); };
+    REQUIRE(stats().staked_items == 3 && stats().stake_count == 2 && stats().units == 300);
+
+    REQUIRE_OK(host.push(rae, CALL(addtostake(1, {4003}))));
+    REQUIRE_OK(host.push(rae, CALL(removefromstake(1, {4000}))));
+    REQUIRE(stats().staked_items == 3 && stats().stake_count == 2 && stats().units == 300);
+
+    //Break the stats, and let the check repair them while the stakes change in the middle of the check
+    extractor_host::collstats_t collstats = host.collstats();
+    collstats.modify(collstats.find(statcoll.value), SELF, [&](auto &_collstats) { _collstats.staked_items = 99; });
+    extractor_host::statscheck_t statscheck(SELF, SELF.value);
+
+    REQUIRE_OK(host.push(BOB, CALL(checkstats(1))));
+    REQUIRE(statscheck.get().phase == STATS_CHECK_TALLY);
+    REQUIRE_OK(host.push(rae, CALL(unstake(1))));
+    REQUIRE_OK(host.push(rae, CALL(stake(rae, {4004, 4005}))));
+    for (int i = 0; i < 100 && statscheck.exists(); i++) {
+        REQUIRE_OK(host.push(BOB, CALL(checkstats(2))));
+    }
+    REQUIRE(!statscheck.exists());
+    REQUIRE(stats().staked_items == 3 && stats().stake_count == 2 && stats().units == 300);
+
+    host.advance(2 * PERIOD);
+    REQUIRE_OK(host.push(rae, CALL(claimstake(2))));
+    REQUIRE(stats().rewards_settled > 0);
+    extractor_host::statstally_t statstally(SELF, SELF.value);
+    REQUIRE(statstally.begin() == statstally.end());
+}
+
+
+TEST(assets_are_weighted_by_a_template_attribute) {
+    extractor_host host;
+    setup(host);
+    name sue = name("sue");
+    name rarecoll = name("rarecoll");
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(rarecoll, 100))));
+    name heroes = name("heroes");
+    std::vector <atomicassets::FORMAT> format = {{"name", "string"}, {"img", "image"}, {"stats", "uint16[]"},
+        {"level", "int32"}, {"rarity", "string"}, {"tier", "uint8"}};
+    host.create_schema(rarecoll, heroes, format);
+
+    //name="A", stats=[300, 5], level=-3, rarity="Epic"
+    std::vector <uint8_t> epic_data = {4, 1, 'A', 6, 2, 0xAC, 0x02, 5, 7, 5, 8, 4, 'E', 'p', 'i', 'c'};
+    host.create_template(rarecoll, 1, true, heroes, epic_data);
+    //name="B", no rarity, tier=2
+    host.create_template(rarecoll, 2, true, heroes, {4, 1, 'B', 9, 2});
+    host.create_template(rarecoll, 3, true, heroes, {8, 4, 'R', 'a', 'r', 'e'});
+
+    atomicdata::ATTRIBUTE_VIEW level = atomicdata::find_attribute(epic_data, format, "level");
+    REQUIRE(level.found && atomicdata::attribute_to_string(epic_data, level) == "-3");
+    REQUIRE(atomicdata::attribute_to_string(epic_data, atomicdata::find_attribute(epic_data, format, "rarity"))
+            == "Epic");
+    REQUIRE(!atomicdata::find_attribute(epic_data, format, "tier").found);
+    REQUIRE(!atomicdata::find_attribute(epic_data, format, "nope").found);
+
+    host.mint_asset(sue, 5001, rarecoll, 1);
+    host.mint_asset(sue, 5002, rarecoll, 2);
+    host.mint_asset(sue, 5003, rarecoll, 3);
+    host.mint_asset(sue, 5004, rarecoll, 1);
+    host.mint_asset(sue, 5005, rarecoll, 3);
+
+    REQUIRE_OK(host.push(SELF, CALL(setrarity(rarecoll, "rarity", {{"Epic", 500}, {"Rare", 200}}, 100))));
+    REQUIRE_FAILS(host.push(SELF, CALL(setrarity(rarecoll, "rarity", {{"Epic", 500}, {"Epic", 200}}, 100))),
+        "multiple times");
+
+    REQUIRE_OK(host.push(sue, CALL(stake(sue, {5001, 5002, 5003, 5004}))));
+    REQUIRE(host.stakes().get(1).units == 500 + 100 + 200 + 500);
+    REQUIRE(host.stakedassets().get(5003).units == 200);
+    extractor_host::tmplweights_t tmplweights(SELF, rarecoll.value);
+    REQUIRE(tmplweights.get(1).weight == 500);
+    //The cached weights are paid by the staker
+    auto tmplweights_rows_of = [&](name payer) {
+        auto ram_itr = emulator::state().ram.find({SELF, name("tmplweights"), "rows", payer});
+        return ram_itr == emulator::state().ram.end() ? 0 : ram_itr->second.rows;
+    };
+    REQUIRE(tmplweights_rows_of(sue) == 3);
+    REQUIRE(tmplweights_rows_of(SELF) == 0);
+
+    REQUIRE_OK(host.push(SELF, CALL(setrarity(rarecoll, "tier", {{"2", 300}}, 100))));
+    REQUIRE_OK(host.push(sue, CALL(addtostake(1, {5005}))));
+    REQUIRE(host.stakedassets().get(5005).units == 100);
+    REQUIRE(tmplweights.get(3).weight == 100);
+    REQUIRE(tmplweights_rows_of(sue) == 3);
+
+    REQUIRE_OK(host.push(SELF, CALL(setrarity(rarecoll, "", {}, 0))));
+    REQUIRE_FAILS(host.push(SELF, CALL(setrarity(rarecoll, "", {}, 0))), "does not have a rarity config");
+}
+
+
+TEST(distribute_settles_stakes_in_batches) {
+    extractor_host host;
+    setup(host);
+    name tom = name("tomtom");
+    name distcoll = name("distcoll");
+    REQUIRE_OK(host.push(SELF, CALL(setcollrate(distcoll, 100))));
+    host.create_template(distcoll, 1, true);
+    mint_assets(host, tom, 6000, 4, distcoll);
+    for (uint64_t asset_id = 6000; asset_id < 6004; asset_id++) {
+        REQUIRE_OK(host.push(tom, CALL(stake(tom, {asset_id}))));
+    }
+    host.advance(3 * PERIOD);
+
+    int64_t pending = 0;
+    for (const auto &stake : host.stakes()) {
+        pending += host.pending_rewards(stake.stake_id);
+    }
+    REQUIRE(pending == 3 * EMISSION_PER_PERIOD);
+
+    for (int i = 0; i < 10; i++) {
+        auto distributed = host.push(name("keeper"), CALL(distribute(3)));
+        REQUIRE_OK(distributed);
+        REQUIRE(extractor_host::count_actions(distributed, SELF, name("logdistrib")) == 1);
+        if (host.cursor(name("distribute")) == 0) {
+            break;
+        }
+    }
+    REQUIRE(host.balance_of(tom) == pending);
+    REQUIRE(host.collstats().get(distcoll.value).rewards_settled == (uint64_t) pending);
+
+    //Nothing is left to settle
+    REQUIRE_OK(host.push(tom, CALL(claimstake(1))));
+    REQUIRE(host.balance_of(tom) == pending);
+    REQUIRE_FAILS(host.push(name("keeper"), CALL(distribute(0))), "max_stakes needs to be at least 1");
+}
+
+
+TEST(distribute_removes_invalid_stakes) {
+    extractor_host host;
+    setup(host);
+    name tom = name("tomtom");
+    mint_assets(host, tom, 6000, 4);
+    REQUIRE_OK(host.push(tom, CALL(stakemany(tom, {{6000}, {6001, 6002}, {6003}}))));
+    host.advance(PERIOD);
+    REQUIRE_OK(host.transfer_assets(tom, BOB, {6002}, ""));
+
+    int64_t valid_pending = host.pending_rewards(1) + host.pending_rewards(3);
+    REQUIRE(valid_pending != 0 && host.pending_rewards(2) != 0);
+
+    auto distributed = host.push(name("keeper"), CALL(distribute(10)));
+    REQUIRE_OK(distributed);
+    REQUIRE(host.balance_of(tom) == valid_pending);
+    REQUIRE(host.stakes().find(2) == host.stakes().end());
+    REQUIRE(host.stakedassets().find(6001) == host.stakedassets().end());
+    REQUIRE(host.rewards().total_units == 200);
+    REQUIRE(host.collstats().get(COLLECTION.value).stake_count == 2);
+
+    //The removed stake and the merged credit of the owner are reported with the logdistrib action
+    REQUIRE(extractor_host::count_actions(distributed, SELF, name("logdistrib")) == 1);
+    for (const auto &action : distributed.actions) {
+        if (action.account == SELF && action.action_name == name("logdistrib")) {
+            auto [examined, removed, credits, quantity, cursor] = unpack <std::tuple <uint64_t, uint64_t,
+                std::vector <extractor_host::OWNER_CREDIT>, asset, uint64_t>>(action.data);
+            REQUIRE(examined == 3 && removed == 1 && quantity.amount == valid_pending);
+            REQUIRE(credits.size() == 1 && credits[0].owner == tom && credits[0].quantity == quantity);
+        }
+    }
+}
+
+
+TEST(failed_transactions_are_rolled_back) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 2);
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {100}))));
+
+    int64_t alice_ram = emulator::ram_of(ALICE);
+    //The first asset is staked before the second one fails the stake
+    REQUIRE_FAILS(host.push(ALICE, CALL(stakemany(ALICE, {{101}, {100}}))), "You have already staked");
+    REQUIRE(host.stakedassets().find(101) == host.stakedassets().end());
+    REQUIRE(emulator::ram_of(ALICE) == alice_ram);
+    REQUIRE(host.last_stake_id() == 1);
+}
+
+
+TEST(ram_is_billed_like_on_chain) {
+    extractor_host host;
+    setup(host);
+    mint_assets(host, ALICE, 100, 1);
+
+    int64_t alice_ram = emulator::ram_of(ALICE);
+    REQUIRE_OK(host.push(ALICE, CALL(stake(ALICE, {100}))));
+    const extractor_host::stake_s &stake = host.stakes().get(1);
+    //stake row with its 2 secondary index rows, the stakedassets row, and the scopes of both tables,
+    //which are billed to the payer of their first row
+    int64_t expected_bytes = 108 + (int64_t) pack_size(stake) + 136 + 136
+                             + 108 + (int64_t) pack_size(host.stakedassets().get(100))
+                             + 2 * 108;
+    REQUIRE(emulator::ram_of(ALICE) - alice_ram == expected_bytes);
+
+    //Other accounts can't be billed without their authorization
+    REQUIRE_FAILS(host.push(BOB, [&](extractor &contract) {
+        extractor_host::collrates_t collrates(SELF, SELF.value);
+        collrates.emplace(ALICE, [&](auto &_collrate) { _collrate.collection_name = name("x"); });
+    }), "missing authority of alice");
+}
+
+
+int main(int argc, char **argv) {
+    return host_test::run_tests(argc, argv);
+}
@@ -0,0 +1,87 @@
+/*
+
+Minimal test runner for the host tests.
+
+TEST(name) registers a test case, REQUIRE(expression) fails the running test case. Every test case gets a fresh
+chain state. The runner takes an optional substring filter of the test case names as its first argument.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace host_test {
+    struct test_case {
+        const char *name;
+        void (*run)();
+    };
+
+    struct failure : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    inline std::vector <test_case> &test_cases() {
+        static std::vector <test_case> cases;
+        return cases;
+    }
+
+    inline bool register_test(const char *name, void (*run)()) {
+        test_cases().push_back({name, run});
+        return true;
+    }
+
+    inline void require(bool condition, const char *expression, const char *file, int line) {
+        if (!condition) {
+            throw failure(std::string(file) + ":" + std::to_string(line) + ": REQUIRE(" + expression + ") failed");
+        }
+    }
+
+    inline int run_tests(int argc, char **argv) {
+        std::string filter = argc > 1 ? argv[1] : "";
+        size_t passed = 0;
+        size_t failed = 0;
+        for (const test_case &current : test_cases()) {
+            if (std::string(current.name).find(filter) == std::string::npos) {
+                continue;
+            }
+            try {
+                current.run();
+                passed++;
+                std::printf("[ ok ] %s\n", current.name);
+            } catch (const std::exception &e) {
+                failed++;
+                std::printf("[FAIL] %s\n       %s\n", current.name, e.what());
+            }
+        }
+        std::printf("%zu passed, %zu failed\n", passed, failed);
+        return failed == 0 && passed != 0 ? 0 : 1;
+    }
+}
+
+#define TEST(NAME) \
+    static void NAME(); \
+    static const bool NAME##_registered = host_test::register_test(#NAME, NAME); \
+    static void NAME()
+
+#define REQUIRE(EXPRESSION) host_test::require((EXPRESSION), #EXPRESSION, __FILE__, __LINE__)
+
+//Requires that an action result succeeded, and reports its error if not
+#define REQUIRE_OK(RESULT) \
+    do { \
+        auto _result = (RESULT); \
+        host_test::require(_result.succeeded, (#RESULT " failed: " + _result.error).c_str(), __FILE__, __LINE__); \
+    } while (0)
+
+//Requires that an action result failed with an error that contains the specified text
+#define REQUIRE_FAILS(RESULT, TEXT) \
+    do { \
+        auto _result = (RESULT); \
+        host_test::require(_result.failed_with(TEXT), \
+            (#RESULT " should fail with \"" + std::string(TEXT) + "\", got: " \
+                + (_result.succeeded ? std::string("success") : _result.error)).c_str(), __FILE__, __LINE__); \
+    } while (0)